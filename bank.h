@@ -0,0 +1,215 @@
+#pragma once
+
+#include "categories.h"
+#include "library.h"
+#include "mixer.h"
+
+#include <SDL2/SDL_mixer.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// A sample bank is a single file with all the samples, already converted to the output format,
+// so that it can be mapped into memory and played from directly. The layout is:
+//
+//   SampleBankHeader
+//   SampleBankEntry, for each sample
+//   the sample filenames, without terminating zeros
+//   the PCM data of each sample, starting at a multiple of sampleBankAlignment
+//
+// All numbers are in the native byte order.
+struct SampleBankHeader {
+    char magic[8];
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint64_t sampleCount;
+    uint64_t fileBytes; // the size of the whole file, so that a truncated file is noticed
+    int32_t defaults[categoryCount]; // the default sample of each category
+    uint32_t reserved;
+};
+
+struct SampleBankEntry {
+    uint64_t dataOffset; // from the start of the file
+    uint64_t dataBytes;
+    uint64_t nameOffset; // from the start of the file
+    uint32_t nameBytes;
+    int32_t category; // -1 if the sample is only a default sample
+    float gain; // the gain that the sample is played at, when the samples are normalized
+    uint32_t reserved;
+};
+
+const char sampleBankMagic[8] = { 'A', 'D', 'B', 'A', 'N', 'K', '0', '2' };
+
+// The PCM data of each sample starts at a multiple of this, so that it can be loaded with aligned SIMD loads
+const uint64_t sampleBankAlignment = 16;
+
+inline uint64_t alignSampleBankOffset(uint64_t offset) { return (offset + sampleBankAlignment - 1) / sampleBankAlignment * sampleBankAlignment; }
+
+// Write all the samples of the library, which must be loaded, and their categories to a sample bank.
+// The samples are written as they are loaded, so trimmed if the library normalizes them.
+// The file is renamed into place, so that running instances never see a partially written file.
+inline bool writeSampleBank(SampleLibrary const& library, CategoryIndex const& index, std::filesystem::path const& path, std::string& error)
+{
+    const size_t count = library.size();
+    std::vector<SampleBankEntry> entries(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (library[static_cast<SampleIndex>(i)] == nullptr) {
+            error = "the sample is not loaded: " + library.filename(static_cast<SampleIndex>(i));
+            return false;
+        }
+        entries[i].category = -1;
+        entries[i].gain = library.gain(static_cast<SampleIndex>(i));
+    }
+    for (int c = 0; c < categoryCount; ++c) {
+        for (auto sample : index[static_cast<Category>(c)]) {
+            entries[sample].category = c;
+        }
+    }
+
+    // Lay out the names after the entries, and the data after the names
+    uint64_t offset = sizeof(SampleBankHeader) + count * sizeof(SampleBankEntry);
+    for (size_t i = 0; i < count; ++i) {
+        entries[i].nameOffset = offset;
+        entries[i].nameBytes = static_cast<uint32_t>(library.filename(static_cast<SampleIndex>(i)).size());
+        offset += entries[i].nameBytes;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        offset = alignSampleBankOffset(offset);
+        entries[i].dataOffset = offset;
+        entries[i].dataBytes = library[static_cast<SampleIndex>(i)]->alen;
+        offset += entries[i].dataBytes;
+    }
+
+    SampleBankHeader header {};
+    memcpy(header.magic, sampleBankMagic, sizeof(sampleBankMagic));
+    header.sampleRate = outputSampleRate;
+    header.channels = outputChannels;
+    header.sampleCount = count;
+    header.fileBytes = offset;
+    for (int c = 0; c < categoryCount; ++c) {
+        header.defaults[c] = index.defaultSample(static_cast<Category>(c));
+    }
+
+    auto tempPath = path;
+    tempPath += ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tempPath, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), count * sizeof(SampleBankEntry));
+        for (size_t i = 0; i < count; ++i) {
+            out.write(library.filename(static_cast<SampleIndex>(i)).data(), entries[i].nameBytes);
+        }
+        const char padding[sampleBankAlignment] = {};
+        for (size_t i = 0; i < count; ++i) {
+            out.write(padding, entries[i].dataOffset - static_cast<uint64_t>(out.tellp()));
+            out.write(reinterpret_cast<const char*>(library[static_cast<SampleIndex>(i)]->abuf), entries[i].dataBytes);
+        }
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tempPath);
+            error = "could not write " + path.string();
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+        error = "could not write " + path.string();
+        return false;
+    }
+    return true;
+}
+
+// Open the audio device and use the samples of a sample bank, instead of loading the sample files.
+// The bank is mapped into memory, shared with other processes that map it, and the samples are
+// played straight from the mapping. Only the header and the entries are read at startup.
+inline bool loadSampleBank(SampleLibrary& library, CategoryIndex& index, std::filesystem::path const& path, std::string& error)
+{
+    openAudio();
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "could not open " + path.string();
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(SampleBankHeader)) {
+        close(fd);
+        error = path.string() + " is not a sample bank";
+        return false;
+    }
+    const auto fileBytes = static_cast<uint64_t>(st.st_size);
+    void* mapping = mmap(nullptr, fileBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        error = "could not map " + path.string();
+        return false;
+    }
+    auto fail = [&](std::string const& message) {
+        munmap(mapping, fileBytes);
+        error = path.string() + ": " + message;
+        return false;
+    };
+
+    const auto* base = static_cast<const Uint8*>(mapping);
+    const auto* header = reinterpret_cast<const SampleBankHeader*>(base);
+    if (memcmp(header->magic, sampleBankMagic, sizeof(sampleBankMagic)) != 0) {
+        return fail("not a sample bank");
+    }
+    if (header->sampleRate != outputSampleRate || header->channels != outputChannels) {
+        return fail("the samples are not in the output format");
+    }
+    const uint64_t count = header->sampleCount;
+    if (header->fileBytes != fileBytes || count > (fileBytes - sizeof(SampleBankHeader)) / sizeof(SampleBankEntry)) {
+        return fail("the file is truncated");
+    }
+    for (int c = 0; c < categoryCount; ++c) {
+        if (header->defaults[c] < 0 || (count > 0 && static_cast<uint64_t>(header->defaults[c]) >= count)) {
+            return fail("invalid default sample");
+        }
+    }
+
+    const auto* entries = reinterpret_cast<const SampleBankEntry*>(base + sizeof(SampleBankHeader));
+    const uint64_t frameBytes = outputChannels * sizeof(int16_t);
+    std::vector<std::string> filenames(count);
+    std::vector<Classification> classifications(count);
+    std::vector<float> gains(count);
+    auto chunks = std::make_unique<Mix_Chunk[]>(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        const auto& entry = entries[i];
+        if (entry.nameOffset > fileBytes || entry.nameBytes > fileBytes - entry.nameOffset
+            || entry.dataOffset > fileBytes || entry.dataBytes > fileBytes - entry.dataOffset
+            || entry.dataOffset % sampleBankAlignment != 0 || entry.dataBytes % frameBytes != 0
+            || entry.dataBytes > UINT32_MAX || entry.category < -1 || entry.category >= categoryCount
+            || !(entry.gain >= minSampleGain && entry.gain <= maxSampleGain)) {
+            return fail("invalid entry for sample " + std::to_string(i));
+        }
+        gains[i] = entry.gain;
+        filenames[i].assign(reinterpret_cast<const char*>(base + entry.nameOffset), entry.nameBytes);
+        if (entry.category >= 0) {
+            classifications[i].category = static_cast<Category>(entry.category);
+        }
+        // Like Mix_QuickLoad_RAW, but without an allocation per sample
+        chunks[i].allocated = 0;
+        chunks[i].abuf = const_cast<Uint8*>(base + entry.dataOffset);
+        chunks[i].alen = static_cast<Uint32>(entry.dataBytes);
+        chunks[i].volume = MIX_MAX_VOLUME;
+    }
+
+    library.assignBank(std::move(filenames), std::move(chunks), gains, mapping, fileBytes);
+    buildCategoryIndex(index, classifications);
+    for (int c = 0; c < categoryCount; ++c) {
+        index.setDefault(static_cast<Category>(c), header->defaults[c]);
+    }
+    return true;
+}
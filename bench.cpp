@@ -0,0 +1,333 @@
+// Microbenchmarks for the hot paths: the sequencer steps, the mixer, the sound generators and the sample loader.
+// The samples are generated into a temporary directory, so that the sample pack is not needed.
+// Run with "make bench".
+
+#include "categories.h"
+#include "effects.h"
+#include "kit.h"
+#include "library.h"
+#include "mixer.h"
+#include "pattern.h"
+#include "render.h"
+#include "rng.h"
+#include "sequencer.h"
+#include "synth.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Each measurement is the fastest of this many batches, and each batch runs for at least benchBatchSeconds
+const int benchBatches = 5;
+const double benchBatchSeconds = 0.05;
+
+// The synthetic sample tree, with this many samples per category
+const int benchSamplesPerCategory = 16;
+
+// A keyword per category, that the sample classifier recognizes
+const std::array<const char*, categoryCount> benchSampleNames = { "kick", "snare", "clhat", "crash", "tom", "ride", "ophat" };
+
+// Keeps the compiler from optimizing away results that are not used
+static volatile int64_t benchSink = 0;
+
+// Time fn, which does one operation per call, and print the time per operation.
+// If framesPerOp is larger than 0, the number of frames that are processed per second is printed as well.
+template <typename Fn>
+void bench(std::string const& name, uint64_t framesPerOp, Fn fn)
+{
+    using clock = std::chrono::steady_clock;
+
+    // Find a batch size that runs for long enough, which also warms up the caches
+    uint64_t batchSize = 1;
+    for (;;) {
+        const auto start = clock::now();
+        for (uint64_t i = 0; i < batchSize; ++i) {
+            fn();
+        }
+        const std::chrono::duration<double> elapsed = clock::now() - start;
+        if (elapsed.count() >= benchBatchSeconds) {
+            break;
+        }
+        batchSize *= 2;
+    }
+
+    double best = std::numeric_limits<double>::max();
+    for (int b = 0; b < benchBatches; ++b) {
+        const auto start = clock::now();
+        for (uint64_t i = 0; i < batchSize; ++i) {
+            fn();
+        }
+        const std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        best = std::min(best, elapsed.count() / static_cast<double>(batchSize));
+    }
+
+    if (framesPerOp > 0) {
+        printf("%-40s %14.1f ns/op %14.0f frames/s\n", name.c_str(), best, static_cast<double>(framesPerOp) * 1e9 / best);
+    } else {
+        printf("%-40s %14.1f ns/op\n", name.c_str(), best);
+    }
+    fflush(stdout);
+}
+
+// Write a mono, 16-bit WAV file
+inline void writeMonoWav(std::filesystem::path const& path, std::vector<int16_t> const& samples)
+{
+    std::ofstream out(path, std::ios::binary);
+    writeWavHeader(out, samples.size(), 1, outputSampleRate);
+    out.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(int16_t));
+}
+
+// Generate a sample tree with a directory per category, and return the total number of frames
+inline uint64_t generateSampleTree(std::filesystem::path const& root)
+{
+    uint64_t frames = 0;
+    for (int c = 0; c < categoryCount; ++c) {
+        const auto directory = root / categoryNames[c];
+        std::filesystem::create_directories(directory);
+        for (int i = 0; i < benchSamplesPerCategory; ++i) {
+            // Different lengths, from 100 to 475 ms, so that the work is uneven, like for a real sample pack
+            const auto samples = generateKickDrum(outputSampleRate, 100 + 25 * i);
+            writeMonoWav(directory / ("bench_"s + benchSampleNames[c] + "_" + std::to_string(i) + ".wav"), samples);
+            frames += samples.size();
+        }
+    }
+    return frames;
+}
+
+// Load the synthetic sample tree, in the current directory, without printing the progress
+inline void loadQuietly(SampleLibrary& library, CategoryIndex& index)
+{
+    std::ostringstream discard;
+    auto* previous = std::cout.rdbuf(discard.rdbuf());
+    InitAndLoad(library, index);
+    std::cout.rdbuf(previous);
+}
+
+int main()
+{
+    const auto root = std::filesystem::temp_directory_path() / ("autodrums-bench-"s + std::to_string(getpid()));
+    const auto tree = root / "samples";
+    const auto cache = root / "cache";
+    std::filesystem::create_directories(tree);
+
+    // Keep the decoded samples away from the real cache
+    setenv("XDG_CACHE_HOME", cache.c_str(), 1);
+
+    SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Keep the audio device open between the loader runs, so that only the loading is measured
+    if (Mix_OpenAudioDevice(outputSampleRate, AUDIO_S16SYS, outputChannels, outputBufferFrames, nullptr, 0) < 0) {
+        std::cerr << "Unable to open audio: " << SDL_GetError() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The sound generators
+    bench("generateKickDrum, 200 ms", outputSampleRate / 5, []() {
+        benchSink = generateKickDrum(outputSampleRate, 200).back();
+    });
+    bench("generateSawtoothWave, 150 ms", outputSampleRate * 3 / 20, []() {
+        benchSink = generateSawtoothWave(bassFrequencies[0] * 2.0, outputSampleRate, 150).back();
+    });
+
+    // The sample loader, with and without the decoded samples in the cache
+    const uint64_t treeFrames = generateSampleTree(tree);
+    const auto previousDirectory = std::filesystem::current_path();
+    std::filesystem::current_path(tree);
+    {
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        SampleLibrary library;
+        CategoryIndex index;
+        loadQuietly(library, index);
+        library.clear();
+        Mix_CloseAudio();
+        const std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        printf("%-40s %14.1f ns/op %14.0f frames/s\n", "InitAndLoad, uncached", elapsed.count(),
+            static_cast<double>(treeFrames) * 1e9 / elapsed.count());
+    }
+    bench("InitAndLoad, cached", treeFrames, []() {
+        SampleLibrary library;
+        CategoryIndex index;
+        loadQuietly(library, index);
+        library.clear();
+        Mix_CloseAudio();
+    });
+    bench("InitAndLoad, lazy", 0, []() {
+        SampleLibrary library;
+        library.setMemoryBudget(std::numeric_limits<size_t>::max());
+        CategoryIndex index;
+        loadQuietly(library, index);
+        library.clear();
+        Mix_CloseAudio();
+    });
+
+    SampleLibrary library;
+    CategoryIndex index;
+    loadQuietly(library, index);
+    std::filesystem::current_path(previousDirectory);
+
+    // The random numbers for the per-step chances and variations, one at a time and a batch at a time
+    {
+        Rng rng(1);
+        bench("Rng uniform", 0, [&]() {
+            benchSink = static_cast<int64_t>(rng.uniform() * 1000.0);
+        });
+        RngBatch batch(Rng(1));
+        bench("RngBatch next", 0, [&]() {
+            benchSink = static_cast<int64_t>(batch.next() * 1000.0f);
+        });
+    }
+
+    // The compiled pattern, one step at a time, without playing anything
+    {
+        const Pattern pattern = defaultPattern();
+        size_t position = 0;
+        bench("Pattern step lookup", 0, [&]() {
+            for (auto const& event : pattern.events(position)) {
+                benchSink = event.volume;
+            }
+            position = position + 1 < pattern.length() ? position + 1 : 0;
+        });
+    }
+
+    // The sequencer, one step at a time, including the mixing of the drums that it plays
+    {
+        Sequencer sequencer(library, defaultKit(index), index, 1);
+        const int frames = sequencer.framesPerStep();
+        std::vector<int16_t> buffer(frames * outputChannels);
+        bench("Sequencer step", frames, [&]() {
+            sequencer.render(buffer.data(), frames);
+        });
+    }
+
+    // Switching to the next kit, which is picked and loaded on a worker thread, as when playing.
+    // Most swaps find that the next kit is not ready yet, which is what the audio thread sees too.
+    {
+        KitPlanner planner(library, index, Rng(1));
+        planner.start();
+        Kit kit = defaultKit(index);
+        pinKit(library, kit);
+        bench("KitPlanner swap", 0, [&]() {
+            benchSink = planner.swap(kit);
+        });
+        planner.stop();
+        unpinKit(library, kit);
+    }
+
+    // Not a benchmark: swap kits as fast as possible, while a lazy library with a small budget keeps evicting
+    // and loading the samples, so that the planner is slow. Every sample must have loaded, and every pin must
+    // have been released afterwards. The paths are relative, so it runs in the sample tree.
+    {
+        std::filesystem::current_path(tree);
+        SampleLibrary lazyLibrary;
+        lazyLibrary.setMemoryBudget(64 * 1024);
+        CategoryIndex lazyIndex;
+        loadQuietly(lazyLibrary, lazyIndex);
+        uint64_t swaps = 0;
+        {
+            KitPlanner planner(lazyLibrary, lazyIndex, Rng(1));
+            planner.start();
+            Kit kit = defaultKit(lazyIndex);
+            pinKit(lazyLibrary, kit);
+            // Pause now and then, so that the planner also gets ahead, and both kits are waiting when the swaps resume
+            Rng pauses(2);
+            const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            for (uint64_t clock = 0; std::chrono::steady_clock::now() < end; clock += outputSampleRate) {
+                // Let everything that is not pinned be evicted
+                lazyLibrary.setClock(clock);
+                if (planner.swap(kit)) {
+                    swaps++;
+                    if (pauses.below(8) == 0) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(pauses.below(5000)));
+                    }
+                }
+            }
+            planner.release();
+            unpinKit(lazyLibrary, kit);
+        }
+        for (size_t i = 0; i < lazyLibrary.size(); ++i) {
+            if (lazyLibrary.pins(static_cast<SampleIndex>(i)) != 0) {
+                std::cerr << "KitPlanner stress: sample " << i << " still has " << lazyLibrary.pins(static_cast<SampleIndex>(i))
+                          << " pins after " << swaps << " swaps" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        // A sample that could not be loaded stays failed, so this also finds the loads of the planner that failed
+        for (size_t i = 0; i < lazyLibrary.size(); ++i) {
+            if (lazyLibrary.acquire(static_cast<SampleIndex>(i)) == nullptr) {
+                std::cerr << "KitPlanner stress: sample " << i << " could not be loaded" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        printf("%-40s %14llu swaps, all pins released\n", "KitPlanner stress", static_cast<unsigned long long>(swaps));
+        lazyLibrary.clear();
+        Mix_CloseAudio();
+        std::filesystem::current_path(previousDirectory);
+    }
+
+    // The mixer, with the given number of voices playing, for one buffer of the audio callback
+    {
+        const SynthVoice longSound(generateSawtoothWave(bassFrequencies[0] * 2.0, outputSampleRate, 10000));
+        std::vector<int16_t> buffer(outputBufferFrames * outputChannels);
+        for (size_t voices : { 1, 8, 32, 128, 256 }) {
+            Mixer mixer(voices);
+            bench("Mixer, " + std::to_string(voices) + " voices, " + std::to_string(outputBufferFrames) + " frames",
+                outputBufferFrames, [&]() {
+                    while (mixer.activeVoices() < voices) {
+                        mixer.play(longSound.get(), 32);
+                    }
+                    mixer.mix(buffer.data(), outputBufferFrames);
+                });
+        }
+    }
+
+    // The effects bus, with one voice going through the echo, and with a reverb on the whole mix
+    {
+        const SynthVoice longSound(generateSawtoothWave(bassFrequencies[0] * 2.0, outputSampleRate, 10000));
+        std::vector<int16_t> buffer(outputBufferFrames * outputChannels);
+        Mixer echoMixer(1);
+        echoMixer.effects().setEcho(outputSampleRate / 10, 0.5f, 0.5f);
+        bench("Mixer, 1 voice with echo, " + std::to_string(outputBufferFrames) + " frames", outputBufferFrames, [&]() {
+            if (echoMixer.activeVoices() == 0) {
+                echoMixer.play(longSound.get(), 32, 1.0f, 1.0f);
+            }
+            echoMixer.mix(buffer.data(), outputBufferFrames);
+        });
+        for (int ms : { 300, 1200 }) {
+            Mixer reverbMixer(1);
+            reverbMixer.effects().setReverb(generateRoomImpulse(outputSampleRate, ms, 1), 0.3f);
+            bench("Mixer, 1 voice with a " + std::to_string(ms) + " ms reverb, " + std::to_string(outputBufferFrames) + " frames",
+                outputBufferFrames, [&]() {
+                    if (reverbMixer.activeVoices() == 0) {
+                        reverbMixer.play(longSound.get(), 32);
+                    }
+                    reverbMixer.mix(buffer.data(), outputBufferFrames);
+                });
+        }
+    }
+
+    library.clear();
+    Mix_CloseAudio();
+    SDL_Quit();
+
+    std::filesystem::remove_all(root);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "rng.h"
+
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+using SampleIndex = int;
+
+// The drum categories that samples are sorted into
+enum class Category { Kick, Snare, HiHat, Crash, Tom, Ride, OpHat };
+
+const int categoryCount = 7;
+
+const std::array<const char*, categoryCount> categoryNames = { "kick", "snare", "hihat", "crash", "tom", "ride", "ophat" };
+
+// The keywords that are looked for in the sample filenames, case insensitively
+enum Keyword {
+    KeywordKick,
+    KeywordSnare,
+    KeywordSnr,
+    KeywordClHat, // closed hi hat
+    KeywordCrash,
+    KeywordNoise,
+    KeywordTom,
+    KeywordRide,
+    KeywordOpHat,
+    KeywordDefaultKick, // the default samples follow, in category order
+    KeywordDefaultSnare,
+    KeywordDefaultHiHat,
+    KeywordDefaultCrash,
+    KeywordDefaultTom,
+    KeywordDefaultRide,
+    KeywordDefaultOpHat,
+    keywordCount
+};
+
+const std::array<std::string_view, keywordCount> sampleKeywords = {
+    "kick", "snare", "snr", "clhat", "crash", "noise", "tom", "ride", "ophat",
+    "cycdh_eleck01-kick02", "acoustic snare-02", "cycdh_sab_clhat-10", "cycdh_trashe-01",
+    "cycdh_k3tom-01", "cycdh_eleck01-cymbal", "cycdh_k3ophat-01"
+};
+
+// What a sample filename was classified as
+struct Classification {
+    std::optional<Category> category; // the category that the sample is used for, if any
+    std::optional<Category> defaultFor; // set if this is the default sample for a category
+};
+
+// SampleClassifier finds all the keywords in a filename in a single pass, with an
+// Aho-Corasick automaton. Case is folded by the table that maps bytes to symbols,
+// so the filenames never need to be copied or converted to lowercase.
+class SampleClassifier {
+public:
+    SampleClassifier()
+    {
+        // Give each character that appears in a keyword its own symbol, the rest map to 0
+        for (auto keyword : sampleKeywords) {
+            for (unsigned char c : keyword) {
+                if (symbols[c] == 0) {
+                    symbols[c] = static_cast<uint8_t>(++symbolCount);
+                    symbols[std::toupper(c)] = symbols[c];
+                }
+            }
+        }
+        ++symbolCount;
+
+        // Build the trie of keywords, with -1 for missing transitions
+        std::vector<int> trie(symbolCount, -1);
+        output.assign(1, 0);
+        for (int k = 0; k < keywordCount; ++k) {
+            int state = 0;
+            for (unsigned char c : sampleKeywords[k]) {
+                int& target = trie[state * symbolCount + symbols[c]];
+                if (target < 0) {
+                    target = static_cast<int>(output.size());
+                    trie.resize(trie.size() + symbolCount, -1);
+                    output.push_back(0);
+                }
+                state = trie[state * symbolCount + symbols[c]];
+            }
+            output[state] |= 1u << k;
+        }
+
+        // Turn the trie into a complete state machine, by following the failure links breadth first
+        const auto stateCount = output.size();
+        next.assign(stateCount * symbolCount, 0);
+        std::vector<int> fail(stateCount, 0);
+        std::vector<int> queue;
+        for (int s = 0; s < symbolCount; ++s) {
+            const int target = trie[s];
+            if (target > 0) {
+                next[s] = static_cast<uint16_t>(target);
+                queue.push_back(target);
+            }
+        }
+        for (size_t q = 0; q < queue.size(); ++q) {
+            const int state = queue[q];
+            for (int s = 0; s < symbolCount; ++s) {
+                const int target = trie[state * symbolCount + s];
+                if (target < 0) {
+                    next[state * symbolCount + s] = next[fail[state] * symbolCount + s];
+                    continue;
+                }
+                next[state * symbolCount + s] = static_cast<uint16_t>(target);
+                fail[target] = next[fail[state] * symbolCount + s];
+                output[target] |= output[fail[target]];
+                queue.push_back(target);
+            }
+        }
+    }
+
+    // Returns a bitmask of the keywords that are found in the given filename
+    uint32_t match(std::string_view filename) const
+    {
+        uint32_t found = 0;
+        size_t state = 0;
+        for (unsigned char c : filename) {
+            state = next[state * symbolCount + symbols[c]];
+            found |= output[state];
+        }
+        return found;
+    }
+
+    Classification classify(std::string_view filename) const
+    {
+        const uint32_t found = match(filename);
+        auto has = [found](Keyword keyword) { return (found & (1u << keyword)) != 0; };
+        Classification result;
+        for (int c = 0; c < categoryCount; ++c) {
+            if (has(static_cast<Keyword>(KeywordDefaultKick + c))) {
+                result.defaultFor = static_cast<Category>(c);
+                break;
+            }
+        }
+        if (has(KeywordKick)) {
+            result.category = Category::Kick;
+        } else if (has(KeywordSnare) || has(KeywordSnr)) {
+            result.category = Category::Snare;
+        } else if (has(KeywordClHat)) {
+            result.category = Category::HiHat;
+        } else if (has(KeywordCrash) && !has(KeywordNoise)) {
+            result.category = Category::Crash;
+        } else if (has(KeywordTom)) {
+            result.category = Category::Tom;
+        } else if (has(KeywordRide)) {
+            result.category = Category::Ride;
+        } else if (has(KeywordOpHat)) {
+            result.category = Category::OpHat;
+        }
+        return result;
+    }
+
+private:
+    std::array<uint8_t, 256> symbols {};
+    int symbolCount = 0;
+    std::vector<uint16_t> next; // the next state, for each state and symbol
+    std::vector<uint32_t> output; // the keywords that end in each state
+};
+
+// CategoryIndex lists the sample indices of each category, in one contiguous array
+class CategoryIndex {
+public:
+    // Build the index from the category of each sample, where the position is the sample index
+    void build(std::vector<std::optional<Category>> const& sampleCategories)
+    {
+        offsets.fill(0);
+        for (auto const& category : sampleCategories) {
+            if (category) {
+                offsets[static_cast<int>(*category) + 1]++;
+            }
+        }
+        for (int c = 0; c < categoryCount; ++c) {
+            offsets[c + 1] += offsets[c];
+        }
+        ids.resize(offsets[categoryCount]);
+        auto position = offsets;
+        for (size_t i = 0; i < sampleCategories.size(); ++i) {
+            if (sampleCategories[i]) {
+                ids[position[static_cast<int>(*sampleCategories[i])]++] = static_cast<SampleIndex>(i);
+            }
+        }
+    }
+
+    void setDefault(Category category, SampleIndex sampleIndex) { defaults[static_cast<int>(category)] = sampleIndex; }
+
+    SampleIndex defaultSample(Category category) const { return defaults[static_cast<int>(category)]; }
+
+    std::span<const SampleIndex> operator[](Category category) const
+    {
+        const int c = static_cast<int>(category);
+        return { ids.data() + offsets[c], ids.data() + offsets[c + 1] };
+    }
+
+    // Select a random sample from the given category, or the default sample if the category is empty
+    SampleIndex random(Category category, Rng& rng) const
+    {
+        const auto samples = (*this)[category];
+        if (samples.empty()) {
+            return defaultSample(category);
+        }
+        return *select_randomly(samples.begin(), samples.end(), rng);
+    }
+
+private:
+    std::vector<SampleIndex> ids;
+    std::array<uint32_t, categoryCount + 1> offsets {};
+    std::array<SampleIndex, categoryCount> defaults {};
+};
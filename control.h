@@ -0,0 +1,210 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// How often the control input wakes up to see if a quit signal has arrived, in milliseconds
+const int controlPollMilliseconds = 200;
+
+// The most bytes that are kept from a control line that has not ended yet
+const size_t maxControlLineLength = 4096;
+
+// Set by SIGINT and SIGTERM, when playing without a window
+inline volatile std::sig_atomic_t quitSignalled = 0;
+
+inline void quitSignalHandler(int) { quitSignalled = 1; }
+
+// Quit cleanly on SIGINT and SIGTERM. Broken socket connections are noticed by read(), not by SIGPIPE.
+inline void installQuitSignalHandlers()
+{
+    struct sigaction action {};
+    action.sa_handler = quitSignalHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+// Turn a control line into key presses. The words of a line are either key names, like
+// "space", "return", "escape" or "quit", or keys that are pressed one after the other, like "a" or "asd".
+inline std::vector<SDL_Keycode> parseControlLine(std::string const& line)
+{
+    std::vector<SDL_Keycode> keys;
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word) {
+        if (word[0] == '#') {
+            break;
+        }
+        if (word == "space") {
+            keys.push_back(SDLK_SPACE);
+        } else if (word == "return" || word == "enter") {
+            keys.push_back(SDLK_RETURN);
+        } else if (word == "escape" || word == "esc" || word == "quit") {
+            keys.push_back(SDLK_ESCAPE);
+        } else {
+            for (char c : word) {
+                keys.push_back(std::tolower(static_cast<unsigned char>(c)));
+            }
+        }
+    }
+    return keys;
+}
+
+// ControlInput reads key presses as lines of text from stdin and, optionally, from the
+// clients of a Unix domain socket, so that the drums can be played without a window.
+class ControlInput {
+public:
+    ControlInput()
+    {
+        sources.push_back({ STDIN_FILENO, "" });
+    }
+
+    ~ControlInput()
+    {
+        for (size_t i = 1; i < sources.size(); ++i) {
+            close(sources[i].fd);
+        }
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+    }
+
+    ControlInput(ControlInput const&) = delete;
+    ControlInput& operator=(ControlInput const&) = delete;
+
+    // Accept connections on a Unix domain socket at the given path, which is replaced if it is a stale socket
+    bool listen(std::filesystem::path const& path, std::string& error)
+    {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (path.native().size() >= sizeof(address.sun_path)) {
+            error = "the socket path is too long: " + path.string();
+            return false;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+        struct stat existing {};
+        if (lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+            unlink(path.c_str());
+        }
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listenFd, 4) < 0) {
+            error = "could not listen on " + path.string() + ": " + std::strerror(errno);
+            if (listenFd >= 0) {
+                close(listenFd);
+                listenFd = -1;
+            }
+            return false;
+        }
+        socketPath = path;
+        return true;
+    }
+
+    // Wait for the next key press. Returns nothing when a quit signal has arrived. The end of stdin
+    // does not quit, so that the drums keep playing after the keys have been piped in.
+    std::optional<SDL_Keycode> next()
+    {
+        while (keys.empty()) {
+            if (quitSignalled) {
+                return std::nullopt;
+            }
+            wait();
+        }
+        const SDL_Keycode key = keys.front();
+        keys.pop_front();
+        return key;
+    }
+
+private:
+    struct Source {
+        int fd;
+        std::string partial; // the start of a line that has not ended yet
+    };
+
+    void wait()
+    {
+        std::vector<pollfd> fds;
+        for (auto const& source : sources) {
+            // A closed stdin is kept in the list, but not polled, so that the client indexes stay the same
+            fds.push_back({ source.fd == STDIN_FILENO && !stdinOpen ? -1 : source.fd, POLLIN, 0 });
+        }
+        if (listenFd >= 0) {
+            fds.push_back({ listenFd, POLLIN, 0 });
+        }
+        if (poll(fds.data(), fds.size(), controlPollMilliseconds) <= 0) {
+            return;
+        }
+        if (listenFd >= 0 && fds.back().revents & POLLIN) {
+            const int client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                sources.push_back({ client, "" });
+            }
+        }
+        // Backwards, so that the clients that have disconnected can be removed as we go
+        for (size_t i = sources.size(); i-- > 0;) {
+            if (fds[i].revents == 0 || !readFrom(sources[i])) {
+                continue;
+            }
+            if (i == 0) {
+                stdinOpen = false;
+            } else {
+                close(sources[i].fd);
+                sources.erase(sources.begin() + i);
+            }
+        }
+    }
+
+    // Read what is available and queue the keys of the complete lines. Returns true at the end of the input.
+    bool readFrom(Source& source)
+    {
+        char buffer[512];
+        const ssize_t length = read(source.fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            return errno != EINTR && errno != EAGAIN;
+        }
+        if (length == 0) {
+            queueLine(source.partial);
+            source.partial.clear();
+            return true;
+        }
+        for (ssize_t i = 0; i < length; ++i) {
+            if (buffer[i] == '\n') {
+                queueLine(source.partial);
+                source.partial.clear();
+            } else if (source.partial.size() < maxControlLineLength) {
+                source.partial.push_back(buffer[i]);
+            }
+        }
+        return false;
+    }
+
+    void queueLine(std::string const& line)
+    {
+        for (auto key : parseControlLine(line)) {
+            keys.push_back(key);
+        }
+    }
+
+    std::vector<Source> sources; // stdin first, then the socket clients
+    bool stdinOpen = true;
+    int listenFd = -1;
+    std::filesystem::path socketPath;
+    std::deque<SDL_Keycode> keys;
+};
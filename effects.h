@@ -0,0 +1,429 @@
+#pragma once
+
+#include "rng.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+// The effects work on interleaved stereo, like the mixer
+const int effectChannels = 2;
+
+// The reverb convolves blocks of this many frames at a time, which is also its latency
+const size_t reverbPartitionFrames = 256;
+
+// The frequency bins of a partition, rounded up for the SIMD loops, which are given zeros to work on
+const size_t reverbBins = reverbPartitionFrames + 1;
+const size_t reverbPaddedBins = (reverbBins + 7) / 8 * 8;
+
+// The longest impulse response, so that the reverb stays cheap enough for the audio thread
+const size_t maxImpulseFrames = 44100 * 6;
+
+// The most that the echo can feed back into itself, so that it always dies out
+const float maxEchoFeedback = 0.95f;
+
+// An effect stops when its tail has faded to this, relative to its input
+const float effectSilenceLevel = 1e-5f;
+
+// Fft is an in-place radix-2 complex FFT of a fixed size, with the tables computed up front,
+// so that transforms can be done from the audio thread
+class Fft {
+public:
+    explicit Fft(size_t n)
+        : size(n)
+        , bitReversed(n)
+        , twiddleRe(n / 2)
+        , twiddleIm(n / 2)
+    {
+        int bits = 0;
+        while ((size_t { 1 } << bits) < n) {
+            ++bits;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            size_t reversed = 0;
+            for (int b = 0; b < bits; ++b) {
+                reversed |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            bitReversed[i] = static_cast<uint32_t>(reversed);
+        }
+        for (size_t k = 0; k < n / 2; ++k) {
+            const double angle = -2.0 * M_PI * static_cast<double>(k) / static_cast<double>(n);
+            twiddleRe[k] = static_cast<float>(std::cos(angle));
+            twiddleIm[k] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    void forward(std::complex<float>* data) const { transform(data, 1.0f); }
+
+    // Not scaled, so the result is size times too large
+    void inverse(std::complex<float>* data) const { transform(data, -1.0f); }
+
+private:
+    // The sign is that of the imaginary part of the twiddles: 1 for the forward transform, -1 for the inverse
+    void transform(std::complex<float>* data, float sign) const
+    {
+        for (size_t i = 0; i < size; ++i) {
+            if (i < bitReversed[i]) {
+                std::swap(data[i], data[bitReversed[i]]);
+            }
+        }
+        // As floats, since std::complex checks for infinities when multiplying, and is slow to take apart
+        auto* d = reinterpret_cast<float*>(data);
+        for (size_t length = 2; length <= size; length *= 2) {
+            const size_t half = length / 2;
+            const size_t stride = size / length;
+            for (size_t start = 0; start < size; start += length) {
+                for (size_t k = 0; k < half; ++k) {
+                    const float wr = twiddleRe[k * stride];
+                    const float wi = twiddleIm[k * stride] * sign;
+                    float* a = d + 2 * (start + k);
+                    float* b = d + 2 * (start + k + half);
+                    const float tr = b[0] * wr - b[1] * wi;
+                    const float ti = b[0] * wi + b[1] * wr;
+                    const float ar = a[0];
+                    const float ai = a[1];
+                    b[0] = ar - tr;
+                    b[1] = ai - ti;
+                    a[0] = ar + tr;
+                    a[1] = ai + ti;
+                }
+            }
+        }
+    }
+
+    size_t size;
+    std::vector<uint32_t> bitReversed;
+    std::vector<float> twiddleRe;
+    std::vector<float> twiddleIm;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+// The AVX2 part of multiplyAccumulateSpectrum. Returns how many products were added.
+__attribute__((target("avx2"))) inline int multiplyAccumulateSpectrumAvx2(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int count)
+{
+    int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        const __m256 xr = _mm256_loadu_ps(xRe + k), xi = _mm256_loadu_ps(xIm + k);
+        const __m256 hr = _mm256_loadu_ps(hRe + k), hi = _mm256_loadu_ps(hIm + k);
+        const __m256 re = _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi));
+        const __m256 im = _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr));
+        _mm256_storeu_ps(accRe + k, _mm256_add_ps(_mm256_loadu_ps(accRe + k), re));
+        _mm256_storeu_ps(accIm + k, _mm256_add_ps(_mm256_loadu_ps(accIm + k), im));
+    }
+    return k;
+}
+#endif
+
+// Add the products of the complex spectra x and h, given as separate real and imaginary parts, to acc.
+// The count must be a multiple of 8.
+inline void multiplyAccumulateSpectrum(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int count)
+{
+    int k = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpuHasAvx2()) {
+        k = multiplyAccumulateSpectrumAvx2(accRe, accIm, xRe, xIm, hRe, hIm, count);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; k + 4 <= count; k += 4) {
+        const __m128 xr = _mm_loadu_ps(xRe + k), xi = _mm_loadu_ps(xIm + k);
+        const __m128 hr = _mm_loadu_ps(hRe + k), hi = _mm_loadu_ps(hIm + k);
+        const __m128 re = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+        const __m128 im = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+        _mm_storeu_ps(accRe + k, _mm_add_ps(_mm_loadu_ps(accRe + k), re));
+        _mm_storeu_ps(accIm + k, _mm_add_ps(_mm_loadu_ps(accIm + k), im));
+    }
+#endif
+    for (; k < count; ++k) {
+        accRe[k] += xRe[k] * hRe[k] - xIm[k] * hIm[k];
+        accIm[k] += xRe[k] * hIm[k] + xIm[k] * hRe[k];
+    }
+}
+
+// Generate the impulse response of a small room, as interleaved stereo: noise with an exponential
+// decay, to -60 dB at the end, and different noise in each channel so that the room sounds wide.
+inline std::vector<float> generateRoomImpulse(int sampleRate, int durationMs, uint64_t seed)
+{
+    const size_t frames = static_cast<size_t>(sampleRate) * durationMs / 1000;
+    std::vector<float> impulse(frames * effectChannels);
+    Rng rng(seed);
+    const double decay = std::exp(std::log(0.001) / static_cast<double>(std::max<size_t>(frames, 1)));
+    double envelope = 1.0;
+    for (size_t i = 0; i < frames; ++i) {
+        for (int c = 0; c < effectChannels; ++c) {
+            impulse[i * effectChannels + c] = static_cast<float>((rng.uniform() * 2.0 - 1.0) * envelope);
+        }
+        envelope *= decay;
+    }
+    return impulse;
+}
+
+// FeedbackDelay is a stereo echo: every repeat comes a fixed time after the one before,
+// and is quieter by the feedback. Only the echoes are output, not the input itself.
+class FeedbackDelay {
+public:
+    // Allocates, so it must not be called while processing
+    void set(int frames, float feedback, float level)
+    {
+        line.assign(static_cast<size_t>(std::max(frames, 1)) * effectChannels, 0.0f);
+        position = 0;
+        gain = std::clamp(feedback, 0.0f, maxEchoFeedback);
+        wet = level;
+        // The number of repeats until the echo is inaudible, plus the first one
+        const int repeats = gain > 0.0f ? static_cast<int>(std::ceil(std::log(effectSilenceLevel) / std::log(gain))) : 0;
+        tailFrames = static_cast<uint64_t>(std::max(frames, 1)) * static_cast<uint64_t>(repeats + 1);
+        quietFrames = tailFrames;
+    }
+
+    bool enabled() const { return !line.empty(); }
+
+    // False once the last echo has died out
+    bool ringing() const { return quietFrames < tailFrames; }
+
+    // Add the echoes of the input to the output. The input may be null, for silence.
+    void process(const float* in, float* out, int frames)
+    {
+        if (in == nullptr) {
+            if (!ringing()) {
+                return;
+            }
+            quietFrames += static_cast<uint64_t>(frames);
+        } else {
+            quietFrames = 0;
+        }
+        const size_t size = line.size();
+        for (int i = 0; i < frames * effectChannels; ++i) {
+            const float echo = line[position];
+            line[position] = (in != nullptr ? in[i] : 0.0f) + gain * echo;
+            out[i] += echo * wet;
+            position = position + 1 == size ? 0 : position + 1;
+        }
+        if (!ringing()) {
+            // Start from silence, without the rounding errors that are left in the line
+            std::fill(line.begin(), line.end(), 0.0f);
+            position = 0;
+        }
+    }
+
+private:
+    std::vector<float> line; // the delayed frames, interleaved
+    size_t position = 0;
+    float gain = 0.0f;
+    float wet = 0.0f;
+    uint64_t tailFrames = 0;
+    uint64_t quietFrames = 0; // since the last input
+};
+
+// ConvolutionReverb convolves its input with an impulse response, like that of a room. The impulse
+// response is cut into partitions of reverbPartitionFrames, and each block of input is transformed
+// once and multiplied with the spectra of all the partitions (uniformly partitioned overlap-save),
+// so that the latency is one partition, whatever the length of the impulse response. Both channels
+// go through one complex FFT, as the real and the imaginary part.
+class ConvolutionReverb {
+public:
+    ConvolutionReverb()
+        : fft(2 * reverbPartitionFrames)
+        , buffer(2 * reverbPartitionFrames)
+    {
+    }
+
+    // Use the given impulse response, in interleaved stereo frames. The response is scaled to unit energy,
+    // and the level sets how loud the reverb is. Allocates, so it must not be called while processing.
+    void set(std::vector<float> const& impulse, float level)
+    {
+        const size_t frames = std::min(impulse.size() / effectChannels, maxImpulseFrames);
+        partitions = (frames + reverbPartitionFrames - 1) / reverbPartitionFrames;
+        double energy = 0.0;
+        for (int c = 0; c < effectChannels; ++c) {
+            double channelEnergy = 0.0;
+            for (size_t i = 0; i < frames; ++i) {
+                channelEnergy += static_cast<double>(impulse[i * effectChannels + c]) * impulse[i * effectChannels + c];
+            }
+            energy = std::max(energy, channelEnergy);
+        }
+        const float scale = energy > 0.0 ? static_cast<float>(1.0 / std::sqrt(energy)) : 0.0f;
+
+        const size_t spectrumFloats = partitions * effectChannels * reverbPaddedBins;
+        responseRe.assign(spectrumFloats, 0.0f);
+        responseIm.assign(spectrumFloats, 0.0f);
+        for (size_t p = 0; p < partitions; ++p) {
+            std::fill(buffer.begin(), buffer.end(), 0.0f);
+            for (size_t i = 0; i < reverbPartitionFrames && p * reverbPartitionFrames + i < frames; ++i) {
+                const size_t frame = p * reverbPartitionFrames + i;
+                buffer[i] = { impulse[frame * effectChannels] * scale, impulse[frame * effectChannels + 1] * scale };
+            }
+            fft.forward(buffer.data());
+            splitSpectrum(responseRe.data() + p * effectChannels * reverbPaddedBins, responseIm.data() + p * effectChannels * reverbPaddedBins);
+        }
+
+        inputRe.assign(spectrumFloats, 0.0f);
+        inputIm.assign(spectrumFloats, 0.0f);
+        sumRe.assign(effectChannels * reverbPaddedBins, 0.0f);
+        sumIm.assign(effectChannels * reverbPaddedBins, 0.0f);
+        history.assign(2 * reverbPartitionFrames * effectChannels, 0.0f);
+        output.assign(reverbPartitionFrames * effectChannels, 0.0f);
+        wet = level;
+        tailFrames = (partitions + 1) * reverbPartitionFrames;
+        reset();
+    }
+
+    bool enabled() const { return partitions > 0; }
+
+    // False once the reverb of the last input has died out
+    bool ringing() const { return quietFrames < tailFrames; }
+
+    // Add the reverb of the input to the output, which may be the same buffer. The input
+    // flag says whether the input has any sound, so that a silent reverb costs nothing.
+    void process(const float* in, float* out, int frames, bool input)
+    {
+        if (!input) {
+            if (!ringing()) {
+                return;
+            }
+            quietFrames += static_cast<uint64_t>(frames);
+        } else {
+            quietFrames = 0;
+        }
+        for (int i = 0; i < frames; ++i) {
+            for (int c = 0; c < effectChannels; ++c) {
+                const size_t j = fill * effectChannels + c;
+                history[reverbPartitionFrames * effectChannels + j] = in[i * effectChannels + c];
+                out[i * effectChannels + c] += output[j] * wet;
+            }
+            if (++fill == reverbPartitionFrames) {
+                convolve();
+                fill = 0;
+            }
+        }
+        if (!ringing()) {
+            reset();
+        }
+    }
+
+private:
+    // Split the transform of two real signals, in the real and the imaginary part of the buffer,
+    // into the first half of the spectrum of each, which is all that a real signal needs
+    void splitSpectrum(float* re, float* im) const
+    {
+        const size_t n = buffer.size();
+        for (size_t k = 0; k < reverbBins; ++k) {
+            const auto z = buffer[k];
+            const auto mirrored = std::conj(buffer[(n - k) % n]);
+            const auto left = (z + mirrored) * 0.5f;
+            const auto difference = (z - mirrored) * 0.5f;
+            re[k] = left.real();
+            im[k] = left.imag();
+            // The difference divided by i
+            re[reverbPaddedBins + k] = difference.imag();
+            im[reverbPaddedBins + k] = -difference.real();
+        }
+    }
+
+    // Convolve the block of input that has just been filled, and replace the output with the result
+    void convolve()
+    {
+        const size_t n = buffer.size();
+        for (size_t i = 0; i < n; ++i) {
+            buffer[i] = { history[i * effectChannels], history[i * effectChannels + 1] };
+        }
+        fft.forward(buffer.data());
+        const size_t slotFloats = effectChannels * reverbPaddedBins;
+        splitSpectrum(inputRe.data() + newest * slotFloats, inputIm.data() + newest * slotFloats);
+
+        // The newest input block goes with the first partition, the one before it with the second, and so on
+        std::fill(sumRe.begin(), sumRe.end(), 0.0f);
+        std::fill(sumIm.begin(), sumIm.end(), 0.0f);
+        size_t slot = newest;
+        for (size_t p = 0; p < partitions; ++p) {
+            multiplyAccumulateSpectrum(sumRe.data(), sumIm.data(), inputRe.data() + slot * slotFloats, inputIm.data() + slot * slotFloats,
+                responseRe.data() + p * slotFloats, responseIm.data() + p * slotFloats, static_cast<int>(slotFloats));
+            slot = slot == 0 ? partitions - 1 : slot - 1;
+        }
+        newest = newest + 1 == partitions ? 0 : newest + 1;
+
+        // Put the two real spectra back together as one, with the right channel as the imaginary part
+        for (size_t k = 0; k < reverbBins; ++k) {
+            const std::complex<float> left(sumRe[k], sumIm[k]);
+            const std::complex<float> right(sumRe[reverbPaddedBins + k], sumIm[reverbPaddedBins + k]);
+            buffer[k] = left + std::complex<float>(-right.imag(), right.real());
+            if (k > 0 && k < reverbBins - 1) {
+                buffer[n - k] = std::conj(left) + std::complex<float>(right.imag(), right.real());
+            }
+        }
+        fft.inverse(buffer.data());
+
+        // The first half wraps around, the second half is the convolution of the new block
+        const float scale = 1.0f / static_cast<float>(n);
+        for (size_t i = 0; i < reverbPartitionFrames; ++i) {
+            output[i * effectChannels] = buffer[reverbPartitionFrames + i].real() * scale;
+            output[i * effectChannels + 1] = buffer[reverbPartitionFrames + i].imag() * scale;
+        }
+        std::copy(history.begin() + reverbPartitionFrames * effectChannels, history.end(), history.begin());
+    }
+
+    void reset()
+    {
+        std::fill(inputRe.begin(), inputRe.end(), 0.0f);
+        std::fill(inputIm.begin(), inputIm.end(), 0.0f);
+        std::fill(history.begin(), history.end(), 0.0f);
+        std::fill(output.begin(), output.end(), 0.0f);
+        fill = 0;
+        newest = 0;
+        quietFrames = tailFrames;
+    }
+
+    Fft fft;
+    std::vector<std::complex<float>> buffer; // two partitions, for the transforms
+    size_t partitions = 0;
+
+    // The spectra of the partitions of the impulse response, and of the latest input blocks, newest first from newest.
+    // Each has the bins of the left channel, then those of the right one.
+    std::vector<float> responseRe;
+    std::vector<float> responseIm;
+    std::vector<float> inputRe;
+    std::vector<float> inputIm;
+    size_t newest = 0;
+    std::vector<float> sumRe;
+    std::vector<float> sumIm;
+
+    std::vector<float> history; // the previous input block and the one that is being filled, interleaved
+    std::vector<float> output; // the reverb of the previous input block, interleaved
+    size_t fill = 0; // frames in the block that is being filled
+    float wet = 0.0f;
+    uint64_t tailFrames = 0;
+    uint64_t quietFrames = 0; // since the last input
+};
+
+// EffectsBus adds an echo and a reverb to the mixed voices. The echo only gets the voices that are sent
+// to it, and the reverb gets the whole mix, with the echoes. Everything is allocated when the effects
+// are set, before mixing, and an effect that has nothing to do is skipped.
+class EffectsBus {
+public:
+    // Must not be called while mixing
+    void setEcho(int frames, float feedback, float level) { delay.set(frames, feedback, level); }
+
+    // Must not be called while mixing
+    void setReverb(std::vector<float> const& impulse, float level) { reverb.set(impulse, level); }
+
+    // True while an effect has input, or a tail that has not died out
+    bool ringing() const { return delay.ringing() || reverb.ringing(); }
+
+    // Add the effects to the mix. The echo input is null if nothing was sent to it, and the
+    // input flag says whether the mix has any sound.
+    void process(float* mix, const float* echo, bool input, int frames)
+    {
+        if (delay.enabled()) {
+            delay.process(echo, mix, frames);
+        }
+        if (reverb.enabled()) {
+            reverb.process(mix, mix, frames, input || delay.ringing());
+        }
+    }
+
+private:
+    FeedbackDelay delay;
+    ConvolutionReverb reverb;
+};
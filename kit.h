@@ -0,0 +1,196 @@
+#pragma once
+
+#include "categories.h"
+#include "library.h"
+#include "rng.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+
+// The samples that are currently used for each drum
+struct Kit {
+    std::array<SampleIndex, categoryCount> samples {};
+
+    SampleIndex& operator[](Category category) { return samples[static_cast<int>(category)]; }
+    SampleIndex operator[](Category category) const { return samples[static_cast<int>(category)]; }
+};
+
+// The default sample of each category
+inline Kit defaultKit(const CategoryIndex& index)
+{
+    Kit kit;
+    for (int c = 0; c < categoryCount; ++c) {
+        kit.samples[c] = index.defaultSample(static_cast<Category>(c));
+    }
+    return kit;
+}
+
+// A random sample of each category
+inline Kit randomKit(const CategoryIndex& index, Rng& rng)
+{
+    Kit kit;
+    for (int c = 0; c < categoryCount; ++c) {
+        kit.samples[c] = index.random(static_cast<Category>(c), rng);
+    }
+    return kit;
+}
+
+inline void pinKit(SampleLibrary& library, const Kit& kit)
+{
+    for (auto sample : kit.samples) {
+        library.pin(sample);
+    }
+}
+
+inline void unpinKit(SampleLibrary& library, const Kit& kit)
+{
+    for (auto sample : kit.samples) {
+        library.unpin(sample);
+    }
+}
+
+// Load the samples on the calling thread, if needed
+inline void acquireKit(SampleLibrary& library, const Kit& kit)
+{
+    for (auto sample : kit.samples) {
+        library.acquire(sample);
+    }
+}
+
+// KitPlanner picks the next random kits ahead of time, pins them and loads their samples, on a worker
+// thread, so that the sequencer can switch kits without waiting. It has two buffers: the next kit,
+// which is handed to the sequencer with an atomic pointer, and the kit after that, which the worker
+// picks while the next one waits. The sequencer gives back its previous kit in the same buffer, and
+// the worker unpins it. The kits come from their own generator, in order, so a seed always gives the
+// same kits, whether the worker keeps up or not.
+class KitPlanner {
+public:
+    // Picks and loads the first kit on the calling thread
+    KitPlanner(SampleLibrary& sampleLibrary, const CategoryIndex& categoryIndex, Rng generator)
+        : library(sampleLibrary)
+        , index(categoryIndex)
+        , rng(generator)
+    {
+        spare = &buffers[0];
+        plan();
+        spare = &buffers[1];
+    }
+
+    ~KitPlanner() { stop(); }
+
+    KitPlanner(KitPlanner const&) = delete;
+    KitPlanner& operator=(KitPlanner const&) = delete;
+
+    // Plan on a worker thread. Without it, the kits are planned by the thread that swaps them, which
+    // is what offline rendering wants, since it may wait for the samples to load.
+    void start()
+    {
+        if (worker.joinable()) {
+            return;
+        }
+        running = true;
+        worker = std::thread([this]() {
+            while (running) {
+                if (!plan()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                }
+            }
+        });
+    }
+
+    // Must be called before the samples are freed
+    void stop()
+    {
+        running = false;
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    // Stop, and unpin the kits that the sequencer has not taken, and the one it gave back. The planner must
+    // not be used afterwards. Releasing again does nothing.
+    void release()
+    {
+        stop();
+        for (Kit* kit : { retired.exchange(nullptr), next.exchange(nullptr), waiting }) {
+            if (kit != nullptr) {
+                unpinKit(library, *kit);
+            }
+        }
+        waiting = nullptr;
+    }
+
+    // Replace the given kit with the next one, if it is ready, and return true. The samples of the new kit
+    // are pinned and loaded. With a worker this takes a constant time, and never waits.
+    bool swap(Kit& current)
+    {
+        if (!worker.joinable()) {
+            plan();
+        }
+        Kit* planned = next.exchange(nullptr, std::memory_order_acq_rel);
+        if (planned == nullptr) {
+            return false;
+        }
+        std::swap(current, *planned);
+        retired.store(planned, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Do the next part of the planning, returns false if there was nothing to do
+    bool plan()
+    {
+        bool worked = false;
+        if (Kit* previous = retired.exchange(nullptr, std::memory_order_acq_rel)) {
+            unpinKit(library, *previous);
+            spare = previous;
+            worked = true;
+        }
+        if (handOver()) {
+            worked = true;
+        }
+        if (waiting == nullptr && spare != nullptr) {
+            *spare = randomKit(index, rng);
+            pinKit(library, *spare);
+            acquireKit(library, *spare);
+            waiting = spare;
+            spare = nullptr;
+            worked = true;
+            // Hand it over right away, if the next kit has been taken while this one was loading
+            handOver();
+        }
+        return worked;
+    }
+
+    // Make the waiting kit the next one, if the sequencer has taken the next kit, and its previous kit has
+    // been unpinned. Only the sequencer empties the next kit, and it only retires a kit when it takes the
+    // next one, so both stay empty until the next kit is set here, and there is never more than one retired kit.
+    bool handOver()
+    {
+        if (waiting == nullptr || next.load(std::memory_order_acquire) != nullptr || retired.load(std::memory_order_acquire) != nullptr) {
+            return false;
+        }
+        next.store(waiting, std::memory_order_release);
+        waiting = nullptr;
+        return true;
+    }
+
+    SampleLibrary& library;
+    const CategoryIndex& index;
+    Rng rng;
+    std::array<Kit, 2> buffers {};
+
+    // Handed between the threads
+    std::atomic<Kit*> next { nullptr }; // picked and loaded, for the sequencer to take
+    std::atomic<Kit*> retired { nullptr }; // the previous kit of the sequencer, to be unpinned
+
+    // Only used by the thread that plans
+    Kit* waiting = nullptr; // picked and loaded, for when the next kit has been taken
+    Kit* spare = nullptr; // to pick the next kit into
+
+    std::atomic<bool> running { false };
+    std::thread worker;
+};
@@ -0,0 +1,673 @@
+#pragma once
+
+#include "categories.h"
+#include "mixer.h"
+#include "parallel.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std::string_literals;
+
+// thanks https://stackoverflow.com/a/874160/131264
+inline bool hasSuffix(std::string const& fullString, std::string const& ending)
+{
+    if (fullString.length() >= ending.length()) {
+        return (0 == fullString.compare(fullString.length() - ending.length(), ending.length(), ending));
+    }
+    return false;
+}
+
+inline bool contains(std::string const& strHaystack, std::string const& strNeedle)
+{
+    return (strHaystack.find(strNeedle) != std::string::npos);
+}
+
+inline std::vector<std::string> findFiles(std::string const& path, std::string const& ext)
+{
+    std::vector<std::string> collected;
+    // Walk each of the top level directories on a separate thread
+    std::vector<std::filesystem::path> directories;
+    for (auto& p : std::filesystem::directory_iterator(path)) {
+        if (p.is_directory() && !p.is_symlink()) {
+            directories.push_back(p.path());
+        } else if (hasSuffix(p.path(), ext)) {
+            collected.push_back(p.path());
+        }
+    }
+    std::vector<std::vector<std::string>> found(directories.size());
+    parallelFor(directories.size(), [&](size_t i) {
+        for (auto& p : std::filesystem::recursive_directory_iterator(directories[i])) {
+            if (hasSuffix(p.path(), ext)) {
+                found[i].push_back(p.path());
+            }
+        }
+    });
+    for (auto& filenames : found) {
+        collected.insert(collected.end(), filenames.begin(), filenames.end());
+    }
+    // The directory order is not stable, sort the files so that the sample indices are the same on every run
+    std::sort(collected.begin(), collected.end());
+    return collected;
+}
+
+// Samples are trimmed after the last frame that is louder than this, which is about -60 dBFS
+const int trailingSilenceLevel = 32;
+
+// The gain of a sample brings its RMS level to this, unless that would make the peak louder than
+// normalizedPeak. Both are fractions of full scale. The gain is kept within minSampleGain and maxSampleGain.
+const float normalizedRms = 0.1f;
+const float normalizedPeak = 0.9f;
+const float minSampleGain = 0.25f;
+const float maxSampleGain = 4.0f;
+
+// The levels of a sample, which are measured when it is decoded, and cached with it
+struct SampleAnalysis {
+    float peak = 0.0f; // from 0 to 1
+    float rms = 0.0f; // of the part before the trailing silence
+    float gain = 1.0f; // brings the sample to the common level
+    uint32_t audibleLength = 0; // in bytes, without the trailing silence, but always at least one frame
+};
+
+// Measure the peak and the RMS level of interleaved stereo frames, find where the trailing silence starts,
+// and find the gain that brings the sample to the common level
+inline SampleAnalysis analyzeSample(const int16_t* samples, uint32_t frames)
+{
+    SampleAnalysis analysis;
+    uint32_t audibleFrames = 0;
+    int peak = 0;
+    for (uint32_t f = 0; f < frames; ++f) {
+        int loudest = 0;
+        for (int c = 0; c < outputChannels; ++c) {
+            loudest = std::max(loudest, std::abs(static_cast<int>(samples[f * outputChannels + c])));
+        }
+        peak = std::max(peak, loudest);
+        if (loudest > trailingSilenceLevel) {
+            audibleFrames = f + 1;
+        }
+    }
+    audibleFrames = std::max<uint32_t>(audibleFrames, std::min<uint32_t>(frames, 1));
+    double sumOfSquares = 0.0;
+    for (uint32_t i = 0; i < audibleFrames * outputChannels; ++i) {
+        const double x = samples[i] / 32768.0;
+        sumOfSquares += x * x;
+    }
+    analysis.peak = static_cast<float>(peak / 32768.0);
+    analysis.rms = audibleFrames > 0 ? static_cast<float>(std::sqrt(sumOfSquares / (audibleFrames * outputChannels))) : 0.0f;
+    if (analysis.rms > 0.0f) {
+        const float gain = std::min(normalizedRms / analysis.rms, normalizedPeak / analysis.peak);
+        analysis.gain = std::clamp(gain, minSampleGain, maxSampleGain);
+    }
+    analysis.audibleLength = audibleFrames * outputChannels * sizeof(int16_t);
+    return analysis;
+}
+
+// The converted sample data is cached on disk, so that the next startup only needs to map it.
+// The whole sample is cached, so that it can also be played without trimming.
+struct SampleCacheHeader {
+    char magic[8];
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint64_t bytes; // the size of the PCM data that follows the header
+    float peak; // the analysis of the sample
+    float rms;
+    float gain;
+    uint32_t audibleLength;
+};
+
+const char sampleCacheMagic[8] = { 'A', 'D', 'S', 'M', 'P', 'L', '0', '2' };
+
+// A sample that has been decoded and converted to the output format, but not registered with SDL_mixer yet
+struct DecodedSample {
+    Uint8* data = nullptr;
+    Uint32 length = 0; // in bytes
+    void* mapping = nullptr; // set if data points into a mapped cache file
+    size_t mappingSize = 0;
+    SampleAnalysis analysis;
+};
+
+// Returns $XDG_CACHE_HOME/autodrums or ~/.cache/autodrums, or an empty path if there is no usable cache directory
+inline std::filesystem::path sampleCacheDirectory()
+{
+    std::filesystem::path directory;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0') {
+        directory = std::filesystem::path(xdg) / "autodrums";
+    } else if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        directory = std::filesystem::path(home) / ".cache" / "autodrums";
+    } else {
+        return {};
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        return {};
+    }
+    return directory;
+}
+
+// The cache filename is a hash of the absolute path, the modification time and the size of the sample file
+inline std::filesystem::path sampleCachePath(std::filesystem::path const& cacheDirectory, std::string const& filename)
+{
+    std::error_code ec;
+    const auto absolutePath = std::filesystem::absolute(filename, ec).string();
+    const auto modified = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+    const auto size = std::filesystem::file_size(filename, ec);
+    if (ec) {
+        return {};
+    }
+    const auto key = absolutePath + '\0' + std::to_string(modified) + '\0' + std::to_string(size);
+    uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.pcm", static_cast<unsigned long long>(hash));
+    return cacheDirectory / name;
+}
+
+// Map a cache file into memory. Returns false if it does not exist or is not valid.
+inline bool mapCachedSample(std::filesystem::path const& cachePath, DecodedSample& decoded)
+{
+    const int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(SampleCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    const auto* header = static_cast<const SampleCacheHeader*>(mapping);
+    if (memcmp(header->magic, sampleCacheMagic, sizeof(sampleCacheMagic)) != 0
+        || header->sampleRate != outputSampleRate || header->channels != outputChannels
+        || header->bytes != st.st_size - sizeof(SampleCacheHeader) || header->audibleLength > header->bytes) {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+    decoded.analysis = { header->peak, header->rms, header->gain, header->audibleLength };
+    decoded.data = static_cast<Uint8*>(mapping) + sizeof(SampleCacheHeader);
+    decoded.length = static_cast<Uint32>(header->bytes);
+    decoded.mapping = mapping;
+    decoded.mappingSize = st.st_size;
+    return true;
+}
+
+// Write the converted sample data to the cache. The file is renamed into place, so that
+// other instances never see a partially written file.
+inline void writeCachedSample(std::filesystem::path const& cachePath, DecodedSample const& decoded)
+{
+    SampleCacheHeader header {};
+    memcpy(header.magic, sampleCacheMagic, sizeof(sampleCacheMagic));
+    header.sampleRate = outputSampleRate;
+    header.channels = outputChannels;
+    header.bytes = decoded.length;
+    header.peak = decoded.analysis.peak;
+    header.rms = decoded.analysis.rms;
+    header.gain = decoded.analysis.gain;
+    header.audibleLength = decoded.analysis.audibleLength;
+    auto tempPath = cachePath;
+    tempPath += ".tmp" + std::to_string(getpid()) + "-" + std::to_string(std::hash<std::thread::id> {}(std::this_thread::get_id()));
+    {
+        std::ofstream out(tempPath, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(decoded.data), decoded.length);
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tempPath);
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+    }
+}
+
+// Load a WAV file and convert it to the output format, or map it from the cache.
+// Safe to call from any thread, since SDL_mixer is not used.
+inline DecodedSample decodeSample(std::string const& filename, std::filesystem::path const& cacheDirectory)
+{
+    DecodedSample decoded;
+    const auto cachePath = cacheDirectory.empty() ? std::filesystem::path {} : sampleCachePath(cacheDirectory, filename);
+    if (!cachePath.empty() && mapCachedSample(cachePath, decoded)) {
+        return decoded;
+    }
+
+    SDL_AudioSpec spec;
+    Uint8* wavData = nullptr;
+    Uint32 wavLength = 0;
+    if (SDL_LoadWAV(filename.c_str(), &spec, &wavData, &wavLength) == nullptr) {
+        return decoded;
+    }
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_S16SYS, outputChannels, outputSampleRate) < 0) {
+        SDL_FreeWAV(wavData);
+        return decoded;
+    }
+    cvt.len = static_cast<int>(wavLength);
+    cvt.buf = static_cast<Uint8*>(SDL_malloc(static_cast<size_t>(wavLength) * cvt.len_mult));
+    if (cvt.buf == nullptr) {
+        SDL_FreeWAV(wavData);
+        return decoded;
+    }
+    memcpy(cvt.buf, wavData, wavLength);
+    SDL_FreeWAV(wavData);
+    if (cvt.needed && SDL_ConvertAudio(&cvt) < 0) {
+        SDL_free(cvt.buf);
+        return decoded;
+    }
+    const int frameSize = outputChannels * sizeof(int16_t);
+    decoded.data = cvt.buf;
+    decoded.length = static_cast<Uint32>((cvt.needed ? cvt.len_cvt : cvt.len) / frameSize * frameSize);
+    decoded.analysis = analyzeSample(reinterpret_cast<const int16_t*>(decoded.data), decoded.length / frameSize);
+
+    if (!cachePath.empty()) {
+        writeCachedSample(cachePath, decoded);
+    }
+    return decoded;
+}
+
+// Wrap decoded sample data in a Mix_Chunk. Mix_QuickLoad_RAW only allocates the chunk,
+// so this can be called from any thread. Falls back on Mix_LoadWAV, for files
+// that SDL_LoadWAV could not handle. Frees the decoded data if no chunk could be made.
+// If trim is true, the chunk ends where the trailing silence starts.
+inline Mix_Chunk* registerSample(DecodedSample const& decoded, std::string const& filename, bool trim)
+{
+    if (decoded.data == nullptr) {
+        return Mix_LoadWAV(filename.c_str());
+    }
+    Uint8* data = decoded.data;
+    Uint32 length = decoded.length;
+    if (trim) {
+        length = decoded.analysis.audibleLength;
+        if (decoded.mapping == nullptr && length < decoded.length) {
+            // Give the memory of the silence back. The pages of a mapping are only read when they are used.
+            if (auto* smaller = static_cast<Uint8*>(SDL_realloc(data, std::max<Uint32>(length, 1))); smaller != nullptr) {
+                data = smaller;
+            }
+        }
+    }
+    Mix_Chunk* chunk = Mix_QuickLoad_RAW(data, length);
+    if (chunk == nullptr) {
+        if (decoded.mapping != nullptr) {
+            munmap(decoded.mapping, decoded.mappingSize);
+        } else {
+            SDL_free(data);
+        }
+        return nullptr;
+    }
+    if (decoded.mapping == nullptr) {
+        // The data was allocated with SDL_malloc, let Mix_FreeChunk free it
+        chunk->allocated = 1;
+    }
+    return chunk;
+}
+
+// SampleLibrary owns the samples. Either all samples are loaded at startup, or, in lazy
+// mode, only the paths are indexed and each sample is loaded when it is first needed.
+// In lazy mode, the least recently used samples are evicted to stay within a memory budget.
+//
+// The audio thread may only use operator[], gain, pin, unpin, touch and setClock,
+// which never block. A sample is only evicted when it is unpinned, and it has not been
+// touched for longer than it takes to play it, so that no voice can still be playing it.
+class SampleLibrary {
+public:
+    ~SampleLibrary() { clear(); }
+
+    // Enable lazy loading, with the given memory budget in bytes. Must be called before InitAndLoad.
+    void setMemoryBudget(size_t bytes)
+    {
+        memoryBudget = bytes;
+        lazy = true;
+    }
+
+    bool isLazy() const { return lazy; }
+
+    // Trim the trailing silence of the samples, and play them at the gain that brings them to a common
+    // level, which is the default. Otherwise the samples are played as they are. Must be called before loading.
+    void setNormalize(bool enabled) { normalize = enabled; }
+
+    bool normalizes() const { return normalize; }
+
+    size_t size() const { return count; }
+
+    // Returns the sample, or nullptr if it is not loaded
+    Mix_Chunk* operator[](SampleIndex i) const { return entries[i].chunk.load(std::memory_order_acquire); }
+
+    std::string const& filename(SampleIndex i) const { return entries[i].filename; }
+
+    // The gain that the sample should be played at, which is 1 if the samples are not normalized.
+    // In lazy mode it is only valid once operator[] has returned the sample.
+    float gain(SampleIndex i) const { return entries[i].gain; }
+
+    // Find the sample with the given path, or with a path that ends with "/" and the given name
+    std::optional<SampleIndex> find(std::string const& name) const
+    {
+        for (size_t i = 0; i < count; ++i) {
+            const auto& filename = entries[i].filename;
+            if (filename == name || hasSuffix(filename, "/" + name)) {
+                return static_cast<SampleIndex>(i);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // A pinned sample is never evicted
+    int pins(SampleIndex i) const { return entries[i].pins.load(std::memory_order_acquire); }
+
+    void pin(SampleIndex i) { entries[i].pins.fetch_add(1, std::memory_order_relaxed); }
+
+    void unpin(SampleIndex i)
+    {
+        touch(i);
+        entries[i].pins.fetch_sub(1, std::memory_order_release);
+    }
+
+    // Mark the sample as used at the current frame
+    void touch(SampleIndex i) { entries[i].lastUsed.store(clock.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+
+    // The sequencer reports how many frames it has played, which is the time base for the evictions
+    void setClock(uint64_t frames) { clock.store(frames, std::memory_order_relaxed); }
+
+    // Load the sample on the calling thread, if it is not already loaded. Never call this from the audio thread.
+    Mix_Chunk* acquire(SampleIndex i)
+    {
+        std::lock_guard<std::mutex> guard(loadLock);
+        auto& entry = entries[i];
+        if (Mix_Chunk* chunk = entry.chunk.load(std::memory_order_acquire); chunk != nullptr || entry.failed) {
+            return chunk;
+        }
+        const auto decoded = decodeSample(entry.filename, cacheDirectory);
+        Mix_Chunk* chunk = registerSample(decoded, entry.filename, normalize);
+        if (chunk == nullptr) {
+            fprintf(stderr, "Could not load %s\n", entry.filename.c_str());
+            entry.failed.store(true, std::memory_order_release);
+            return nullptr;
+        }
+        makeRoom(chunk->alen);
+        entry.mapping = decoded.mapping;
+        entry.mappingSize = decoded.mappingSize;
+        entry.gain = normalize ? decoded.analysis.gain : 1.0f;
+        entry.lastUsed.store(clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        residentBytes += chunk->alen;
+        entry.chunk.store(chunk, std::memory_order_release);
+        return chunk;
+    }
+
+    // Free all samples
+    void clear()
+    {
+        if (bankMapping != nullptr) {
+            // The chunks of a sample bank are not allocated by SDL_mixer, and their data is in the mapping
+            bankChunks.reset();
+            munmap(bankMapping, bankMappingSize);
+            bankMapping = nullptr;
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                evict(entries[i]);
+            }
+        }
+        entries.reset();
+        count = 0;
+        residentBytes = 0;
+    }
+
+    // Index the given files, the samples can then be loaded with acquire
+    void assign(std::vector<std::string>&& filenames, std::filesystem::path const& cachePath)
+    {
+        clear();
+        cacheDirectory = cachePath;
+        count = filenames.size();
+        entries = std::make_unique<Entry[]>(count);
+        for (size_t i = 0; i < count; ++i) {
+            entries[i].filename = std::move(filenames[i]);
+        }
+    }
+
+    // Use a sample that has already been loaded, by registerSample
+    void assignLoaded(SampleIndex i, Mix_Chunk* chunk, DecodedSample const& decoded)
+    {
+        std::lock_guard<std::mutex> guard(loadLock);
+        auto& entry = entries[i];
+        entry.mapping = decoded.mapping;
+        entry.mappingSize = decoded.mappingSize;
+        entry.gain = normalize ? decoded.analysis.gain : 1.0f;
+        residentBytes += chunk->alen;
+        entry.chunk.store(chunk, std::memory_order_release);
+    }
+
+    // Use the samples of a mapped sample bank. The chunks point into the mapping, and both are
+    // owned by the library from now on. All samples count as loaded, since the pages of the
+    // mapping are read in by the kernel when they are first played, so lazy loading is turned off.
+    void assignBank(std::vector<std::string>&& filenames, std::unique_ptr<Mix_Chunk[]> chunks, std::vector<float> const& gains, void* mapping, size_t mappingSize)
+    {
+        assign(std::move(filenames), {});
+        lazy = false;
+        bankChunks = std::move(chunks);
+        bankMapping = mapping;
+        bankMappingSize = mappingSize;
+        for (size_t i = 0; i < count; ++i) {
+            residentBytes += bankChunks[i].alen;
+            entries[i].gain = normalize ? gains[i] : 1.0f;
+            entries[i].chunk.store(&bankChunks[i], std::memory_order_release);
+        }
+    }
+
+private:
+    struct Entry {
+        std::string filename;
+        std::atomic<Mix_Chunk*> chunk { nullptr };
+        std::atomic<bool> failed { false };
+        std::atomic<int> pins { 0 };
+        std::atomic<uint64_t> lastUsed { 0 }; // in frames, see setClock
+        float gain = 1.0f; // set before the chunk, so that it can be read once the chunk has been seen
+        void* mapping = nullptr; // set if the sample data is a mapped cache file
+        size_t mappingSize = 0;
+    };
+
+    // Samples may still be heard for a while after they were triggered, because of delayed hits and fade-outs
+    static const uint64_t evictionMargin = outputSampleRate * 2;
+
+    void evict(Entry& entry)
+    {
+        Mix_Chunk* chunk = entry.chunk.exchange(nullptr, std::memory_order_acq_rel);
+        if (chunk == nullptr) {
+            return;
+        }
+        residentBytes -= std::min<size_t>(residentBytes, chunk->alen);
+        Mix_FreeChunk(chunk);
+        if (entry.mapping != nullptr) {
+            munmap(entry.mapping, entry.mappingSize);
+            entry.mapping = nullptr;
+        }
+    }
+
+    // A sample can be evicted if it is loaded, not pinned, and has not been played for long enough
+    // that it cannot still be heard
+    bool evictable(Entry const& entry, uint64_t now) const
+    {
+        Mix_Chunk* chunk = entry.chunk.load(std::memory_order_relaxed);
+        if (chunk == nullptr || entry.pins.load(std::memory_order_acquire) > 0) {
+            return false;
+        }
+        const uint64_t frames = chunk->alen / (outputChannels * sizeof(int16_t));
+        return entry.lastUsed.load(std::memory_order_relaxed) + frames + evictionMargin <= now;
+    }
+
+    // Evict the least recently used samples until the given number of bytes fits within the budget.
+    // The candidates are collected and sorted once, and each one is checked again just before it is
+    // evicted, since the audio thread may have pinned or played it in the meantime.
+    void makeRoom(size_t bytes)
+    {
+        if (residentBytes + bytes <= memoryBudget) {
+            return;
+        }
+        const uint64_t now = clock.load(std::memory_order_relaxed);
+        evictionCandidates.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (evictable(entries[i], now)) {
+                evictionCandidates.push_back({ entries[i].lastUsed.load(std::memory_order_relaxed), static_cast<SampleIndex>(i) });
+            }
+        }
+        std::sort(evictionCandidates.begin(), evictionCandidates.end());
+        for (auto [lastUsed, i] : evictionCandidates) {
+            if (residentBytes + bytes <= memoryBudget) {
+                return;
+            }
+            if (evictable(entries[i], now)) {
+                evict(entries[i]);
+            }
+        }
+        // If everything else is in use, go over the budget for now
+    }
+
+    std::unique_ptr<Entry[]> entries;
+    size_t count = 0;
+    std::filesystem::path cacheDirectory;
+
+    bool lazy = false;
+    bool normalize = true;
+    size_t memoryBudget = 0;
+    size_t residentBytes = 0; // protected by loadLock
+    std::vector<std::pair<uint64_t, SampleIndex>> evictionCandidates; // by last use, kept to reuse the memory, protected by loadLock
+    std::mutex loadLock;
+    std::atomic<uint64_t> clock { 0 };
+
+    // Set if the samples are in a mapped sample bank
+    std::unique_ptr<Mix_Chunk[]> bankChunks;
+    void* bankMapping = nullptr;
+    size_t bankMappingSize = 0;
+};
+
+// Set up the audio stream. No format changes are allowed, since the sequencer
+// mixes the sample data directly into the output stream.
+inline void openAudio()
+{
+    const int result = Mix_OpenAudioDevice(outputSampleRate, AUDIO_S16SYS, outputChannels, outputBufferFrames, nullptr, 0);
+    if (result < 0) {
+        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
+        exit(-1);
+    }
+}
+
+// Build the index of which samples belong to which category, where the position is the sample index
+inline void buildCategoryIndex(CategoryIndex& index, std::vector<Classification> const& classifications)
+{
+    std::vector<std::optional<Category>> sampleCategories;
+    for (size_t i = 0; i < classifications.size(); ++i) {
+        if (classifications[i].defaultFor) {
+            index.setDefault(*classifications[i].defaultFor, static_cast<SampleIndex>(i));
+        }
+        sampleCategories.push_back(classifications[i].category);
+    }
+    index.build(sampleCategories);
+    for (int c = 0; c < categoryCount; ++c) {
+        if (index[static_cast<Category>(c)].empty()) {
+            std::cerr << "Found no " << categoryNames[c] << "s!" << std::endl;
+        }
+    }
+}
+
+// Initializes the application data and fills in the sample library, and an index of which
+// samples belong to which category. In lazy mode, the samples are only indexed.
+inline void InitAndLoad(SampleLibrary& library, CategoryIndex& index)
+{
+    openAudio();
+
+    // Find all wav files that fit one of the categories, or that are one of the default samples
+    const SampleClassifier classifier;
+    std::vector<std::string> filenames;
+    std::vector<Classification> classifications;
+    for (auto& filename : findFiles(".", ".wav")) {
+        if (contains(filename, "bpm"s) || contains(filename, "loop"s)) {
+            // Skip samples that are loops or drum loops
+            continue;
+        }
+        const auto classification = classifier.classify(filename);
+        if (classification.category || classification.defaultFor) {
+            filenames.push_back(std::move(filename));
+            classifications.push_back(classification);
+        }
+    }
+
+    const auto cacheDirectory = sampleCacheDirectory();
+    std::vector<Mix_Chunk*> chunks;
+    std::vector<DecodedSample> decoded;
+    if (library.isLazy()) {
+        std::cout << "Indexed " << filenames.size() << " samples" << std::endl;
+    } else {
+        // Decode and convert the files on all cores, or map them from the cache
+        std::cout << "Loading ";
+        decoded.resize(filenames.size());
+        parallelFor(filenames.size(), [&](size_t i) {
+            decoded[i] = decodeSample(filenames[i], cacheDirectory);
+        });
+
+        // Register the samples with SDL_mixer, and leave out the ones that could not be loaded
+        size_t kept = 0;
+        uint64_t trimmedBytes = 0;
+        for (size_t i = 0; i < filenames.size(); ++i) {
+            std::cout << ".";
+            Mix_Chunk* chunk = registerSample(decoded[i], filenames[i], library.normalizes());
+            if (chunk == nullptr) {
+                fprintf(stderr, "\nCould not load %s\n", filenames[i].c_str());
+                continue;
+            }
+            chunks.push_back(chunk);
+            if (decoded[i].data != nullptr) {
+                trimmedBytes += decoded[i].length - chunk->alen;
+            }
+            if (kept != i) {
+                // Moving a string to itself would leave it empty
+                filenames[kept] = std::move(filenames[i]);
+                classifications[kept] = classifications[i];
+                decoded[kept] = decoded[i];
+            }
+            kept++;
+        }
+        filenames.resize(kept);
+        classifications.resize(kept);
+        std::cout << std::endl;
+        if (trimmedBytes > 0) {
+            std::cout << "Trimmed " << static_cast<double>(trimmedBytes) / (outputSampleRate * outputChannels * sizeof(int16_t))
+                      << " seconds of trailing silence" << std::endl;
+        }
+    }
+
+    library.assign(std::move(filenames), cacheDirectory);
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        library.assignLoaded(static_cast<SampleIndex>(i), chunks[i], decoded[i]);
+    }
+
+    buildCategoryIndex(index, classifications);
+}
@@ -1,277 +1,756 @@
+#include "bank.h"
+#include "control.h"
+#include "effects.h"
+#include "library.h"
+#include "parallel.h"
+#include "patternfile.h"
+#include "render.h"
+#include "rng.h"
+#include "sequencer.h"
+#include "stats.h"
+#include "stream.h"
+#include "synth.h"
+
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
-#include <filesystem>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
-#include <iterator>
+#include <mutex>
+#include <optional>
 #include <random>
 #include <string>
 #include <thread>
-#include <unistd.h>
 #include <vector>
 
 using namespace std::string_literals;
 
-using SampleIndex = int;
+const auto versionString = "autodrums 1.1.0"s;
 
-const int maxChannels = 32;
+// The length of the generated room, for "--reverb room"
+const int roomImpulseMs = 1200;
+
+// Settings from the command line
+struct Options {
+    double renderSeconds = 0.0; // render to a file instead of playing, if larger than 0
+    std::string renderFilename = "autodrums.wav";
+    uint64_t seed = 0;
+    size_t sampleMemoryBytes = 0; // load the samples lazily, within this budget, if larger than 0
+    std::string patternFilename; // a pattern file to load, and to watch for changes when playing
+    double statsInterval = 0.0; // print the audio statistics to stderr this often, in seconds, if larger than 0
+    std::string statsFilename; // write the audio statistics to this file, as JSON, when quitting
+    std::string bankFilename; // map the samples from this sample bank, instead of loading the sample files
+    std::string writeBankFilename; // write the samples to this sample bank, and quit
+    bool rawSamples = false; // play the samples as they are, without trimming the silence or normalizing the level
+    std::string streamFilename; // stream the drums to this file or named pipe, or to stdout for "-"
+    StreamFormat streamFormat = StreamFormat::S16;
+    StreamPacing streamPacing = StreamPacing::Clock;
+    std::string streamEventsFilename; // write the steps and hits of the stream to this file, as CSV
+    std::string onsetsFilename; // write the hits of the render to this onset index, as CSV if it ends with .csv
+    std::string midiFilename; // write the hits to this Standard MIDI File, when quitting
+    size_t batchCount = 0; // render this many files, with the seeds seed, seed + 1 and so on, if larger than 0
+    bool headless = false; // play without a window, with the keys from stdin or the control socket
+    std::string controlSocket; // also read keys from the clients of this Unix domain socket, when headless
+    double echoMilliseconds = defaultEchoMilliseconds; // the time between the repeats of the echo
+    float echoFeedback = defaultEchoFeedback; // how loud each repeat of the echo is, compared to the one before
+    std::string reverbFilename; // the impulse response of the reverb, as a WAV file, or "room" for a generated room
+    float reverbLevel = 0.3f;
+};
 
-const auto versionString = "autodrums 1.1.0"s;
+// Write the statistics of the audio thread to the file that is given in the options, if any
+void writeStats(Sequencer const& sequencer, Options const& options)
+{
+    if (options.statsFilename.empty()) {
+        return;
+    }
+    std::ofstream out(options.statsFilename);
+    writeStatsJson(out, sequencer.statistics());
+    if (!out) {
+        std::cerr << "Could not write " << options.statsFilename << std::endl;
+    }
+}
 
-// thanks https://stackoverflow.com/a/16421677/131264
-template <typename Iter, typename RandomGenerator>
-Iter select_randomly(Iter start, Iter end, RandomGenerator& g)
+// Write the hits to the MIDI file that is given in the options, if any. Returns false if it could not be written.
+bool writeMidi(MidiWriter const& midi, Options const& options)
 {
-    std::uniform_int_distribution<> dis(0, std::distance(start, end) - 1);
-    std::advance(start, dis(g));
-    return start;
+    if (options.midiFilename.empty()) {
+        return true;
+    }
+    if (!midi.write(options.midiFilename)) {
+        std::cerr << "Could not write " << options.midiFilename << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << midi.hits() << " hits to " << options.midiFilename << std::endl;
+    return true;
 }
 
-// thanks https://stackoverflow.com/a/16421677/131264
-template <typename Iter>
-Iter select_randomly(Iter start, Iter end)
+// Load a pattern file into the sequencer. It is used from the start of the next bar.
+bool loadPattern(Sequencer& sequencer, std::string const& filename)
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    return select_randomly(start, end, gen);
+    std::string error;
+    auto settings = loadPatternFile(filename, error);
+    if (!settings || !sequencer.loadSettings(std::move(*settings), error)) {
+        std::cerr << "Could not load the pattern: " << error << std::endl;
+        return false;
+    }
+    return true;
 }
 
-// thanks https://stackoverflow.com/a/874160/131264
-inline bool hasSuffix(std::string const& fullString, std::string const& ending)
+// Load the samples from the sample bank that is given in the options, or from the sample files in the
+// current directory. Also opens the audio device. Returns false if the sample bank could not be used.
+bool loadSamples(Options const& options, SampleLibrary& library, CategoryIndex& index)
 {
-    if (fullString.length() >= ending.length()) {
-        return (0 == fullString.compare(fullString.length() - ending.length(), ending.length(), ending));
+    library.setNormalize(!options.rawSamples);
+    if (options.bankFilename.empty()) {
+        if (options.sampleMemoryBytes > 0) {
+            library.setMemoryBudget(options.sampleMemoryBytes);
+        }
+        InitAndLoad(library, index);
+        return true;
     }
-    return false;
+    std::string error;
+    if (!loadSampleBank(library, index, options.bankFilename, error)) {
+        std::cerr << "Could not load the sample bank: " << error << std::endl;
+        Mix_CloseAudio();
+        return false;
+    }
+    std::cout << "Mapped " << library.size() << " samples from " << options.bankFilename << std::endl;
+    return true;
 }
 
-inline bool contains(std::string const& strHaystack, std::string const& strNeedle)
+// Load the impulse response of the reverb that is given in the options, in the output format. Returns an
+// empty response if there is no reverb, and nothing if the file could not be loaded. The audio must be open.
+std::optional<std::vector<float>> loadImpulse(Options const& options)
 {
-    return (strHaystack.find(strNeedle) != std::string::npos);
+    if (options.reverbFilename.empty()) {
+        return std::vector<float> {};
+    }
+    if (options.reverbFilename == "room") {
+        return generateRoomImpulse(outputSampleRate, roomImpulseMs, 1);
+    }
+    Mix_Chunk* chunk = Mix_LoadWAV(options.reverbFilename.c_str());
+    if (chunk == nullptr) {
+        std::cerr << "Could not load the impulse response " << options.reverbFilename << ": " << SDL_GetError() << std::endl;
+        return std::nullopt;
+    }
+    const auto* samples = reinterpret_cast<const int16_t*>(chunk->abuf);
+    std::vector<float> impulse(chunk->alen / sizeof(int16_t));
+    for (size_t i = 0; i < impulse.size(); ++i) {
+        impulse[i] = static_cast<float>(samples[i]) / 32768.0f;
+    }
+    Mix_FreeChunk(chunk);
+    if (impulse.size() / outputChannels > maxImpulseFrames) {
+        std::cerr << "The impulse response is cut to " << maxImpulseFrames / outputSampleRate << " seconds" << std::endl;
+    }
+    return impulse;
 }
 
-// case insensitive contains
-inline bool iContains(const std::string& strHaystack, const std::string& strNeedle)
+// Set up the echo and the reverb of a sequencer, before it renders
+void setUpEffects(Sequencer& sequencer, Options const& options, std::vector<float> const& impulse)
 {
-    // thanks https://stackoverflow.com/a/19839371/131264
-    auto it = std::search(strHaystack.begin(), strHaystack.end(), strNeedle.begin(), strNeedle.end(),
-        [](char ch1, char ch2) { return std::toupper(ch1) == std::toupper(ch2); });
-    return it != strHaystack.end();
+    sequencer.setEcho(options.echoMilliseconds, options.echoFeedback, defaultEchoLevel);
+    if (!impulse.empty()) {
+        sequencer.setReverb(impulse, options.reverbLevel);
+    }
 }
 
-inline const std::vector<std::string> findFiles(std::string const& path, std::string const& ext)
+// Load the sample files in the current directory, and write them to a sample bank
+int writeBankMain(Options const& options)
 {
-    std::vector<std::string> collected;
-    for (auto& p : std::filesystem::recursive_directory_iterator(path)) {
-        if (hasSuffix(p.path(), ext)) {
+    SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return EXIT_FAILURE;
+    }
+    atexit(SDL_Quit);
+
+    SampleLibrary library;
+    library.setNormalize(!options.rawSamples);
+    CategoryIndex index;
+    InitAndLoad(library, index);
+
+    std::string error;
+    const bool ok = writeSampleBank(library, index, options.writeBankFilename, error);
+    if (ok) {
+        std::cout << "Wrote " << library.size() << " samples to " << options.writeBankFilename << std::endl;
+    } else {
+        std::cerr << "Could not write the sample bank: " << error << std::endl;
+    }
 
-            collected.push_back(p.path());
+    library.clear();
+    Mix_CloseAudio();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Reload the pattern file that is given in the options, if any, whenever it is saved
+void watchPattern(FileWatcher& watcher, Sequencer& sequencer, Options const& options)
+{
+    if (options.patternFilename.empty()) {
+        return;
+    }
+    const bool watching = watcher.start(options.patternFilename, [&sequencer, &options]() {
+        if (loadPattern(sequencer, options.patternFilename)) {
+            std::cout << "Reloaded " << options.patternFilename << std::endl;
         }
+    });
+    if (!watching) {
+        std::cerr << "Could not watch " << options.patternFilename << " for changes" << std::endl;
     }
-    return collected;
 }
 
-static const std::vector<double> bassFrequencies = {
-    16.35, // C0
-    17.32, // C#0/Db0
-    18.35, // D0
-    19.45, // D#0/Eb0
-    20.60, // E0
-    21.83, // F0
-    23.12, // F#0/Gb0
-    24.50, // G0
-    25.96, // G#0/Ab0
-    27.50, // A0
-    29.14, // A#0/Bb0
-    30.87 // B0
-};
+// Stream the drums as raw PCM, without a window or an audio device, until the reader goes away
+// or the program is stopped. The output is the same as when rendering with the same seed.
+int streamMain(Options const& options, int fd)
+{
+    SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return EXIT_FAILURE;
+    }
+    atexit(SDL_Quit);
+    installQuitSignalHandlers();
+
+    SampleLibrary library;
+    CategoryIndex index;
+    if (!loadSamples(options, library, index)) {
+        return EXIT_FAILURE;
+    }
+    const auto impulse = loadImpulse(options);
+    if (!impulse) {
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
+
+    Sequencer sequencer(library, defaultKit(index), index, options.seed);
+    setUpEffects(sequencer, options, *impulse);
+    sequencer.setEventRecording(!options.streamEventsFilename.empty() || !options.midiFilename.empty());
+    if (!options.patternFilename.empty() && !loadPattern(sequencer, options.patternFilename)) {
+        sequencer.stopKitPlanner();
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
+    FileWatcher patternWatcher;
+    watchPattern(patternWatcher, sequencer, options);
+
+    std::ofstream events;
+    if (!options.streamEventsFilename.empty()) {
+        events.open(options.streamEventsFilename);
+        if (!events) {
+            std::cerr << "Could not write " << options.streamEventsFilename << std::endl;
+            sequencer.stopKitPlanner();
+            library.clear();
+            Mix_CloseAudio();
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "Streaming to " << options.streamFilename << std::endl;
+    const auto totalFrames = static_cast<uint64_t>(options.renderSeconds * outputSampleRate);
+    MidiWriter midi;
+    const uint64_t frames = streamPcm(sequencer, fd, options.streamFormat, options.streamPacing, totalFrames,
+        options.streamEventsFilename.empty() ? nullptr : &events, options.midiFilename.empty() ? nullptr : &midi);
+    std::cout << "Streamed " << static_cast<double>(frames) / outputSampleRate << " seconds" << std::endl;
+
+    patternWatcher.stop();
+    writeStats(sequencer, options);
+    writeMidi(midi, options);
 
-int16_t* generateSawtoothWave(double freq, int sampleRate, int durationMs, double cutoffFreq = 500.0)
+    sequencer.stopKitPlanner();
+    library.clear();
+    Mix_CloseAudio();
+
+    return EXIT_SUCCESS;
+}
+
+// Render the drums to a file, faster than realtime, without a window or an audio device
+int renderMain(Options const& options)
 {
-    const int amplitude = 32767;
-    const int iTotalSamples = sampleRate * durationMs / 1000;
-    int16_t* wave = new int16_t[iTotalSamples];
-    double rc = 1.0 / (cutoffFreq * 2 * M_PI);
-    double dt = 1.0 / sampleRate;
-    double alpha = dt / (rc + dt);
+    // The dummy audio driver is only needed for loading and converting the samples
+    SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return EXIT_FAILURE;
+    }
+    atexit(SDL_Quit);
 
-    double previous = 0.0; // Previous filtered sample
+    SampleLibrary library;
+    CategoryIndex index;
+    if (!loadSamples(options, library, index)) {
+        return EXIT_FAILURE;
+    }
+    const auto impulse = loadImpulse(options);
+    if (!impulse) {
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
 
-    for (int i = 0; i < iTotalSamples; ++i) {
-        double envelope = 1.0; // Simplified envelope for clarity
-        double sample = envelope * (2.0 * (i % (static_cast<int>(static_cast<double>(sampleRate) / freq)) / static_cast<double>(sampleRate / freq) - 0.5));
+    Sequencer sequencer(library, defaultKit(index), index, options.seed);
+    setUpEffects(sequencer, options, *impulse);
+    if (!options.patternFilename.empty() && !loadPattern(sequencer, options.patternFilename)) {
+        sequencer.stopKitPlanner();
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
 
-        // Apply the low-pass filter
-        sample = alpha * sample + (1.0 - alpha) * previous;
-        previous = sample;
+    OnsetIndexWriter onsets(library);
+    const bool indexed = !options.onsetsFilename.empty();
+    sequencer.setEventRecording(indexed || !options.midiFilename.empty());
+    if (indexed && !onsets.open(options.onsetsFilename)) {
+        std::cerr << "Could not write " << options.onsetsFilename << std::endl;
+        sequencer.stopKitPlanner();
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
 
-        // Scale and convert to 16-bit integer
-        wave[i] = static_cast<int16_t>(amplitude * sample);
+    std::cout << "Rendering " << options.renderSeconds << " seconds to " << options.renderFilename << std::endl;
+    const auto startTime = std::chrono::steady_clock::now();
+    MidiWriter midi;
+    bool ok = renderToFile(sequencer, options.renderSeconds, options.renderFilename, indexed ? &onsets : nullptr,
+        options.midiFilename.empty() ? nullptr : &midi);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    if (ok) {
+        std::cout << "Rendered in " << elapsed.count() << " seconds" << std::endl;
+    } else {
+        std::cerr << "Could not write " << options.renderFilename << std::endl;
+    }
+    if (indexed) {
+        if (onsets.finish() && ok) {
+            std::cout << "Wrote " << onsets.count() << " onsets to " << options.onsetsFilename << std::endl;
+        } else {
+            std::cerr << "Could not write " << options.onsetsFilename << std::endl;
+            ok = false;
+        }
     }
-    return wave;
+    if (ok) {
+        ok = writeMidi(midi, options);
+    }
+    writeStats(sequencer, options);
+
+    sequencer.stopKitPlanner();
+    library.clear();
+    Mix_CloseAudio();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int16_t* generateKickDrum(int sampleRate, int durationMs)
+// Handle a key press, from the window or from the control input. Returns false if the program should quit.
+bool handleKey(SDL_Keycode key, Sequencer& sequencer, SynthBank const& synths, Rng& rng)
 {
-    const int amplitude = 32767; // Max amplitude for 16-bit audio
-    const int totalSamples = sampleRate * durationMs / 1000;
-    int16_t* wave = new int16_t[totalSamples];
-    double frequencyStart = 120.0; // Start frequency slightly lowered
-    double frequencyEnd = 60.0; // End frequency for a deeper sound
-    double envelopeStrength = 0.3; // Adjust the decay to be less abrupt
-
-    for (int i = 0; i < totalSamples; ++i) {
-        double time = i / static_cast<double>(sampleRate);
-        double frequency = frequencyStart + (frequencyEnd - frequencyStart) * (i / static_cast<double>(totalSamples)); // Linear pitch decrease
-        double envelope = amplitude * exp(-envelopeStrength * time); // Smooth exponential decay envelope
-        double sample = envelope * sin(2 * M_PI * frequency * time);
-        wave[i] = static_cast<int16_t>(sample);
-    }
-    return wave;
+    switch (key) {
+    case 'a': // kick
+        sequencer.trigger(Category::Kick, 128);
+        break;
+    case SDLK_RETURN: // snare with delay
+        // One hit, that also goes to the echo of the effects bus, so the repeats cost no voices
+        sequencer.trigger(Category::Snare, 128, 0, 1.0f);
+        break;
+    case 'w': // snare
+    case 'f': // snare
+        sequencer.trigger(Category::Snare, 128);
+        break;
+    case 'd': // crash
+        sequencer.trigger(Category::Crash, 128);
+        break;
+    case 's': // hi-hat
+        sequencer.trigger(Category::HiHat, 128);
+        break;
+    case 'q': // tom
+        sequencer.trigger(Category::Tom, 128);
+        break;
+    case 'e': // ride
+        sequencer.trigger(Category::Ride, 128);
+        break;
+    case 'x': // open hi-hat
+        sequencer.trigger(Category::OpHat, 128);
+        break;
+    case 'o': // output sample indexes
+        sequencer.printSampleIndices(std::cerr);
+        break;
+    case 'r': // randomize samples
+        sequencer.randomizeSamples();
+        break;
+    case 'p': // pause toggle
+        sequencer.togglePlaying();
+        break;
+    case 'm': // increase the bpm
+        sequencer.changeTempo(5.0);
+        break;
+    case 'n': // decrease the bpm
+        sequencer.changeTempo(-5.0);
+        break;
+    case 'y': // use the current settings, don't change samples
+        sequencer.useCurrentSettings();
+        break;
+    case 'i': // toggle "random beat skip"
+        sequencer.toggleRandomBeatSkip();
+        break;
+    case 'j': // toggle "use random beat silence"
+        sequencer.toggleRandomBeatSilence();
+        break;
+    case SDLK_ESCAPE: // quit
+        return false;
+    case SDLK_SPACE: // fade-out and then pause toggle
+        // Fade out for 200 ms, the sequencer toggles the pause when the fade is done
+        sequencer.fadeOutAndTogglePlaying(200);
+        break;
+    case 'v': // play a generated sawtooth sound
+        sequencer.playSound(synths.bassSound(rng.below(bassFrequencies.size())), 128);
+        break;
+    case 'b': // play generated kick drum sound
+        sequencer.playSound(synths.kickSound(), 128);
+        break;
+    default:
+        break;
+    }
+    return true;
 }
 
-static SampleIndex defaultKick = 0;
-static SampleIndex defaultSnare = 0;
-static SampleIndex defaultHiHat = 0;
-static SampleIndex defaultCrash = 0;
-static SampleIndex defaultTom = 0;
-static SampleIndex defaultRide = 0;
-static SampleIndex defaultOpHat = 0;
-
-// Initializes the application data and return a vector of samples
-std::vector<Mix_Chunk*> InitAndLoad(std::vector<SampleIndex>& kicks,
-    std::vector<SampleIndex>& snares, std::vector<SampleIndex>& hihats,
-    std::vector<SampleIndex>& crashes, std::vector<SampleIndex>& toms,
-    std::vector<SampleIndex>& rides, std::vector<SampleIndex>& ophats)
+// Play the drums until quitting. The keys come from the window, if there is a renderer, or from the control input.
+int playMain(Options const& options, SDL_Renderer* ren, SDL_Texture* tex)
 {
+    // Open the control socket before loading the samples, so that a bad path fails fast
+    std::optional<ControlInput> controls;
+    if (ren == nullptr) {
+        controls.emplace();
+        std::string error;
+        if (!options.controlSocket.empty() && !controls->listen(options.controlSocket, error)) {
+            std::cerr << "Could not open the control socket: " << error << std::endl;
+            return EXIT_FAILURE;
+        }
+        installQuitSignalHandlers();
+    }
 
-    // Set up the audio stream
-    int result = Mix_OpenAudio(44100, AUDIO_S16SYS, 2, 512);
-    if (result < 0) {
-        fprintf(stderr, "Unable to open audio: %s\n", SDL_GetError());
-        exit(-1);
+    SampleLibrary library;
+    CategoryIndex index;
+
+    // Application specific Initialize of data structures
+    if (!loadSamples(options, library, index)) {
+        return EXIT_FAILURE;
+    }
+    const auto impulse = loadImpulse(options);
+    if (!impulse) {
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
     }
 
-    result = Mix_AllocateChannels(maxChannels);
-    if (result < 0) {
-        fprintf(stderr, "Unable to allocate mixing channels: %s\n", SDL_GetError());
-        exit(-1);
+    // The drum beat is played from the audio callback, so that the timing is sample-accurate
+    Sequencer sequencer(library, defaultKit(index), index, options.seed);
+    setUpEffects(sequencer, options, *impulse);
+    if (!options.patternFilename.empty() && !loadPattern(sequencer, options.patternFilename)) {
+        sequencer.stopKitPlanner();
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
+    // The hits are read on a thread of their own, since the main thread waits for the keys
+    MidiWriter midi;
+    std::atomic<bool> recordingMidi { !options.midiFilename.empty() };
+    sequencer.setEventRecording(recordingMidi);
+    std::thread midiRecorder;
+    if (recordingMidi) {
+        midiRecorder = std::thread([&sequencer, &midi, &recordingMidi]() {
+            for (bool last = false; !last;) {
+                last = !recordingMidi;
+                for (SequencerEvent event; sequencer.nextEvent(event);) {
+                    addMidiEvent(midi, event);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        });
     }
+    sequencer.startKitPlanner();
+    Mix_SetPostMix(Sequencer::postMix, &sequencer);
 
-    // All the samples
-    std::vector<Mix_Chunk*> samples;
+    // Reload the pattern file whenever it is saved, without stopping the beat
+    FileWatcher patternWatcher;
+    watchPattern(patternWatcher, sequencer, options);
 
-    // Find and load all wav files
-    std::cout << "Loading ";
-    SampleIndex sampleIndex = 0;
-    for (auto filename : findFiles(".", ".wav")) {
-        if (contains(filename, "bpm"s) || contains(filename, "loop"s)) {
-            // Skip samples that are loops or drum loops
-            continue;
-        }
-        // std::cout << "Loading " << filename << std::endl;
+    // Report how the audio thread is doing, for tuning the buffer size
+    StatsReporter statsReporter;
+    if (options.statsInterval > 0.0) {
+        statsReporter.start(sequencer.statistics(), options.statsInterval);
+    }
+
+    // The generated sounds are rendered up front, so that the keys never block
+    const SynthBank synths;
 
-        std::cout << ".";
-        auto sample = Mix_LoadWAV(filename.c_str());
-        if (sample == nullptr) {
-            fprintf(stderr, "\nCould not load %s\n", filename.c_str());
-            continue;
+    // Used for the generated sounds, on a separate stream from the sequencer
+    Rng rng(options.seed);
+    rng.jump();
+
+    if (controls) {
+        // Block until there is a key press, the audio thread takes care of the beat
+        while (auto key = controls->next()) {
+            if (!handleKey(*key, sequencer, synths, rng)) {
+                break;
+            }
+        }
+    } else {
+        // Event descriptor
+        SDL_Event Event;
+
+        bool done = false;
+        bool redraw = true;
+
+        // Block until there is an event, the audio thread takes care of the beat.
+        // The image never changes, so it is only drawn when the window needs it.
+        while (!done) {
+            if (redraw) {
+                SDL_RenderClear(ren);
+                SDL_RenderCopy(ren, tex, nullptr, nullptr);
+                SDL_RenderPresent(ren);
+                redraw = false;
+            }
+            if (!SDL_WaitEvent(&Event)) {
+                break;
+            }
+            switch (Event.type) {
+            case SDL_KEYDOWN:
+                done = !handleKey(Event.key.keysym.sym, sequencer, synths, rng);
+                break;
+            case SDL_WINDOWEVENT:
+                redraw = Event.window.event == SDL_WINDOWEVENT_EXPOSED || Event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED;
+                break;
+            case SDL_QUIT:
+                done = true;
+                break;
+            default:
+                break;
+            }
         }
+    }
+
+    // Stop the sequencer before the samples are freed
+    patternWatcher.stop();
+    Mix_SetPostMix(nullptr, nullptr);
+    sequencer.stopKitPlanner();
+    recordingMidi = false;
+    if (midiRecorder.joinable()) {
+        midiRecorder.join();
+    }
+    writeMidi(midi, options);
 
-        auto foundSpecific = false;
-        if (iContains(filename, "cycdh_eleck01-kick02")) {
-            // std::cout << "FOUND KICK " << filename << ", " << sampleIndex << std::endl;
-            defaultKick = sampleIndex;
-            foundSpecific = true;
-        } else if (iContains(filename, "acoustic snare-02")) {
-            // std::cout << "FOUND SNARE " << filename << ", " << sampleIndex << std::endl;
-            defaultSnare = sampleIndex;
-            foundSpecific = true;
-        } else if (iContains(filename, "cycdh_sab_clhat-10")) {
-            // std::cout << "FOUND HIHAT " << filename << ", " << sampleIndex << std::endl;
-            defaultHiHat = sampleIndex;
-            foundSpecific = true;
-        } else if (iContains(filename, "cycdh_trashe-01")) {
-            // std::cout << "FOUND CRASH " << filename << ", " << sampleIndex << std::endl;
-            defaultCrash = sampleIndex;
-            foundSpecific = true;
-        } else if (iContains(filename, "cycdh_k3tom-01")) {
-            // std::cout << "FOUND TOM " << filename << ", " << sampleIndex << std::endl;
-            defaultTom = sampleIndex;
-            foundSpecific = true;
-        } else if (iContains(filename, "cycdh_eleck01-cymbal")) {
-            // std::cout << "FOUND RIDE " << filename << ", " << sampleIndex << std::endl;
-            defaultRide = sampleIndex;
-            foundSpecific = true;
-        } else if (iContains(filename, "cycdh_k3ophat-01")) {
-            // std::cout << "FOUND OPHAT " << filename << ", " << sampleIndex << std::endl;
-            defaultOpHat = sampleIndex;
-            foundSpecific = true;
+    statsReporter.stop();
+    if (options.statsInterval > 0.0) {
+        printStatsLine(std::cerr, sequencer.statistics());
+    }
+    writeStats(sequencer, options);
+
+    // Free samples
+    library.clear();
+
+    Mix_CloseAudio();
+
+    return EXIT_SUCCESS;
+}
+
+// Render a batch of files with different seeds, in parallel. The samples are loaded once and
+// shared by all the sequencers, which only read them.
+int batchMain(Options const& options)
+{
+    SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return EXIT_FAILURE;
+    }
+    atexit(SDL_Quit);
+
+    // Lazy loading evicts samples based on the time of a single sequencer, so all samples are loaded up front
+    Options eager = options;
+    if (options.sampleMemoryBytes > 0) {
+        std::cerr << "--sample-memory-mb is ignored when rendering a batch" << std::endl;
+        eager.sampleMemoryBytes = 0;
+    }
+    SampleLibrary library;
+    CategoryIndex index;
+    if (!loadSamples(eager, library, index)) {
+        return EXIT_FAILURE;
+    }
+    const auto impulse = loadImpulse(options);
+    if (!impulse) {
+        library.clear();
+        Mix_CloseAudio();
+        return EXIT_FAILURE;
+    }
+
+    std::optional<PatternSettings> settings;
+    if (!options.patternFilename.empty()) {
+        std::string error;
+        settings = loadPatternFile(options.patternFilename, error);
+        if (!settings) {
+            std::cerr << "Could not load the pattern: " << error << std::endl;
+            library.clear();
+            Mix_CloseAudio();
+            return EXIT_FAILURE;
         }
+    }
 
-        auto foundCategory = true;
-        if (iContains(filename, "kick")) {
-            // printf("Sample index %d filename %s is a kick!\n", sampleIndex, filename.c_str());
-            kicks.push_back(sampleIndex);
-        } else if (iContains(filename, "snare") || iContains(filename, "snr")) {
-            // printf("Sample index %d filename %s is a snare!\n", sampleIndex, filename.c_str());
-            snares.push_back(sampleIndex);
-        } else if (iContains(filename, "clhat")) { // closed hi hat
-            // printf("Sample index %d filename %s is a closed hi hat!\n", sampleIndex,
-            // filename.c_str());
-            hihats.push_back(sampleIndex);
-        } else if (iContains(filename, "crash") && !iContains(filename, "noise")) {
-            // printf("Sample index %d filename %s is a crash!\n", sampleIndex, filename.c_str());
-            crashes.push_back(sampleIndex);
-        } else if (iContains(filename, "tom")) {
-            toms.push_back(sampleIndex);
-        } else if (iContains(filename, "ride")) {
-            rides.push_back(sampleIndex);
-        } else if (iContains(filename, "ophat")) {
-            ophats.push_back(sampleIndex);
+    std::cout << "Rendering " << options.batchCount << " times " << options.renderSeconds << " seconds" << std::endl;
+    const auto startTime = std::chrono::steady_clock::now();
+    std::atomic<size_t> failures { 0 };
+    std::mutex outputLock;
+    parallelFor(options.batchCount, [&](size_t i) {
+        const uint64_t seed = options.seed + i;
+        const auto filename = batchFilename(options.renderFilename, i, options.batchCount);
+        Sequencer sequencer(library, defaultKit(index), index, seed);
+        setUpEffects(sequencer, options, *impulse);
+        std::string error;
+        bool ok = !settings || sequencer.loadSettings(*settings, error);
+        OnsetIndexWriter onsets(library);
+        const bool indexed = !options.onsetsFilename.empty();
+        const bool recordingMidi = !options.midiFilename.empty();
+        sequencer.setEventRecording(indexed || recordingMidi);
+        if (indexed) {
+            const auto onsetsFilename = batchFilename(options.onsetsFilename, i, options.batchCount);
+            if (ok && !onsets.open(onsetsFilename)) {
+                error = "could not write " + onsetsFilename;
+                ok = false;
+            }
+        }
+        MidiWriter midi;
+        ok = ok && renderToFile(sequencer, options.renderSeconds, filename, indexed ? &onsets : nullptr, recordingMidi ? &midi : nullptr);
+        if (indexed && !onsets.finish() && ok) {
+            error = "could not write the onset index";
+            ok = false;
+        }
+        if (recordingMidi && ok && !midi.write(batchFilename(options.midiFilename, i, options.batchCount))) {
+            error = "could not write the MIDI file";
+            ok = false;
+        }
+        std::lock_guard<std::mutex> guard(outputLock);
+        if (ok) {
+            std::cout << "Wrote " << filename << " with seed " << seed << std::endl;
         } else {
-            foundCategory = false;
-            // printf("WOOT? %s\n", filename.c_str());
+            std::cerr << "Could not render " << filename << (error.empty() ? "" : ": " + error) << std::endl;
+            failures++;
         }
+    });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    std::cout << "Rendered in " << elapsed.count() << " seconds, "
+              << options.renderSeconds * static_cast<double>(options.batchCount) / elapsed.count() << " times realtime" << std::endl;
 
-        if (foundCategory || foundSpecific) {
-            // Only keep the samples that fit one of the above categories
-            samples.push_back(sample);
-            sampleIndex++;
-        }
-    }
-    std::cout << std::endl;
-
-    auto w = ""s;
-    if (kicks.size() == 0) {
-        w = "kick";
-    } else if (snares.empty()) {
-        w = "snare";
-    } else if (hihats.empty()) {
-        w = "hihat";
-    } else if (crashes.empty()) {
-        w = "crash";
-    } else if (crashes.empty()) {
-        w = "tom";
-    } else if (rides.empty()) {
-        w = "ride";
-    } else if (ophats.empty()) {
-        w = "ophat";
-    }
-    if (!w.empty()) {
-        std::cerr << "Found no " << w << "s!" << std::endl;
-    }
-
-    return samples;
+    library.clear();
+    Mix_CloseAudio();
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char** argv)
 {
+    Options options;
+    options.seed = std::random_device {}();
+    for (int argi = 1; argi < argc; ++argi) {
+        const std::string arg = argv[argi];
+        if (arg == "--render" && argi + 1 < argc) {
+            options.renderSeconds = std::atof(argv[++argi]);
+        } else if (arg == "--out" && argi + 1 < argc) {
+            options.renderFilename = argv[++argi];
+        } else if (arg == "--seed" && argi + 1 < argc) {
+            options.seed = std::strtoull(argv[++argi], nullptr, 10);
+        } else if (arg == "--sample-memory-mb" && argi + 1 < argc) {
+            options.sampleMemoryBytes = static_cast<size_t>(std::atof(argv[++argi]) * 1024 * 1024);
+        } else if (arg == "--pattern" && argi + 1 < argc) {
+            options.patternFilename = argv[++argi];
+        } else if (arg == "--stats" && argi + 1 < argc) {
+            options.statsInterval = std::atof(argv[++argi]);
+        } else if (arg == "--stats-out" && argi + 1 < argc) {
+            options.statsFilename = argv[++argi];
+        } else if (arg == "--onsets" && argi + 1 < argc) {
+            options.onsetsFilename = argv[++argi];
+        } else if (arg == "--midi" && argi + 1 < argc) {
+            options.midiFilename = argv[++argi];
+        } else if (arg == "--batch" && argi + 1 < argc) {
+            options.batchCount = std::strtoull(argv[++argi], nullptr, 10);
+        } else if (arg == "--bank" && argi + 1 < argc) {
+            options.bankFilename = argv[++argi];
+        } else if (arg == "--write-bank" && argi + 1 < argc) {
+            options.writeBankFilename = argv[++argi];
+        } else if (arg == "--stream" && argi + 1 < argc) {
+            options.streamFilename = argv[++argi];
+        } else if (arg == "--stream-format" && argi + 1 < argc && parseStreamFormat(argv[argi + 1])) {
+            options.streamFormat = *parseStreamFormat(argv[++argi]);
+        } else if (arg == "--stream-pace" && argi + 1 < argc && parseStreamPacing(argv[argi + 1])) {
+            options.streamPacing = *parseStreamPacing(argv[++argi]);
+        } else if (arg == "--stream-events" && argi + 1 < argc) {
+            options.streamEventsFilename = argv[++argi];
+        } else if (arg == "--echo-ms" && argi + 1 < argc) {
+            options.echoMilliseconds = std::atof(argv[++argi]);
+        } else if (arg == "--echo-feedback" && argi + 1 < argc) {
+            options.echoFeedback = static_cast<float>(std::atof(argv[++argi]));
+        } else if (arg == "--reverb" && argi + 1 < argc) {
+            options.reverbFilename = argv[++argi];
+        } else if (arg == "--reverb-level" && argi + 1 < argc) {
+            options.reverbLevel = static_cast<float>(std::atof(argv[++argi]));
+        } else if (arg == "--raw-samples") {
+            options.rawSamples = true;
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--control-socket" && argi + 1 < argc) {
+            options.headless = true;
+            options.controlSocket = argv[++argi];
+        } else {
+            std::cerr << "Usage: autodrums [--seed SEED] [--sample-memory-mb MB] [--raw-samples] [--bank FILENAME | --write-bank FILENAME] [--pattern FILENAME] [--midi FILENAME] [--echo-ms MS] [--echo-feedback AMOUNT] [--reverb FILENAME|room [--reverb-level LEVEL]] [--stats SECONDS] [--stats-out FILENAME] [--headless [--control-socket PATH]] [--stream PATH [--stream-format s16|f32] [--stream-pace clock|reader] [--stream-events FILENAME]] [--render SECONDS [--out FILENAME] [--onsets FILENAME] [--batch COUNT]]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // When streaming to stdout, the messages go to stderr instead
+    int streamFd = -1;
+    if (options.streamFilename == "-") {
+        streamFd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
     std::cout << versionString << std::endl;
 
+    // The same seed gives the same beat, when rendering
+    std::cout << "Seed: " << options.seed << std::endl;
+
+    if (!options.streamFilename.empty()) {
+        if (streamFd < 0) {
+            streamFd = openStreamOutput(options.streamFilename);
+        }
+        if (streamFd < 0) {
+            std::cerr << "Could not open " << options.streamFilename << " for writing" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const int status = streamMain(options, streamFd);
+        close(streamFd);
+        return status;
+    }
+    if (!options.writeBankFilename.empty()) {
+        return writeBankMain(options);
+    }
+    if (options.renderSeconds > 0.0 && options.batchCount > 0) {
+        return batchMain(options);
+    }
+    if (options.renderSeconds > 0.0) {
+        return renderMain(options);
+    }
+
+    if (options.headless) {
+        // Only the audio subsystem, so that no display is needed
+        if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+            std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+            return EXIT_FAILURE;
+        }
+        atexit(SDL_Quit);
+        return playMain(options, nullptr, nullptr);
+    }
+
     // Initialize the SDL library with the Video subsystem
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
     atexit(SDL_Quit);
@@ -322,355 +801,7 @@ int main(int argc, char** argv)
     }
     SDL_FreeSurface(bmp);
 
-    std::vector<SampleIndex> kicks, snares, hihats, crashes, toms, rides, ophats;
-
-    // Application specific Initialize of data structures
-    auto samples = InitAndLoad(kicks, snares, hihats, crashes, toms, rides, ophats);
-
-    SampleIndex currentKick = defaultKick; // kicks[0]
-    SampleIndex currentSnare = defaultSnare; // snares[0];
-    SampleIndex currentHiHat = defaultHiHat; // hihats[0]
-    SampleIndex currentCrash = defaultCrash; // crashes[0]
-    SampleIndex currentTom = defaultTom; // toms[0]
-    SampleIndex currentRide = defaultRide; // rides[0]
-    SampleIndex currentOpHat = defaultOpHat; // ophats[0]
-
-    // Event descriptor
-    SDL_Event Event;
-
-    bool done = false;
-    int beatCounter = 0;
-    const int maxBeatCounter = 16;
-
-    // Default settings for playing a drum beat
-    bool beatPlaying = true;
-
-    double bpm = 500.0; // TODO: this is not beats per minute, fix it
-
-    // The initial drum pattern
-    const auto kPat = "k   k   Kk  k   "s; // k for kick, K for double kick
-    const auto sPat = "  s           s "s; // s for snare
-    const auto hPat = " h h hhh  hh h h"s; // h for hihat
-    const auto cPat = "        c       "s; // c for crash
-    const auto tPat = "t               "s; // t for tom
-    const auto rPat = "  r             "s; // r for raid
-    const auto oPat = "    o           "s; // o for open hihat
-
-    bool useRandomBeatSkip = true; // randomize the beat by skipping ahead?
-    bool useRandomBeatSilence = true; // randomize the beat by silencing some beats?
-    bool useRandomSamples = true; // randomize the samples?
-
-    double randomChanceBeatSkip = 0.6; // 60% chance of skipping a beat so that everything shifts
-    double randomChanceBeatSilence = 0.005; // 0.5% chance of silencing a beat
-    double randomChanceNewSamples = 0.01; // 1% chance of choosing other samples
-
-    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-    std::chrono::steady_clock::time_point soundTime = std::chrono::steady_clock::now();
-
-    while (!done) {
-
-        SDL_RenderClear(ren);
-        SDL_RenderCopy(ren, tex, nullptr, nullptr);
-        SDL_RenderPresent(ren);
-
-        bool gotEvent = SDL_PollEvent(&Event);
-
-        const auto delay = 100000;
-        int volume = 128;
-
-        std::vector<int> usedChannels;
-        int i, freeChannel = -1;
-
-        while (!done && (gotEvent || beatPlaying)) {
-            switch (Event.type) {
-            case SDL_KEYDOWN:
-                switch (Event.key.keysym.sym) {
-                case 'a': // kick
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-                    Mix_PlayChannel(i, samples[currentKick], 0);
-                    break;
-                case SDLK_RETURN: // snare with delay
-                    // TODO: Don't play the sample repeatedly,
-                    //       rather prepare the sample in advance.
-                    volume = 128;
-                    for (i = (maxChannels - 4); i < maxChannels; ++i) {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, volume);
-                        Mix_PlayChannel(freeChannel, samples[currentSnare], 0);
-                        usleep(delay);
-                        volume /= 2;
-                        usedChannels.push_back(freeChannel);
-                    }
-                    // for (auto i : usedChannels) {
-                    //    Mix_FadeOutChannel(i, 200);
-                    //}
-                    usedChannels.clear();
-                    // usedChannels = nullptr;
-                    break;
-                case 'w': // snare
-                case 'f': // snare
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-                    Mix_PlayChannel(i, samples[currentSnare], 0);
-                    break;
-                case 'd': // crash
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-
-                    Mix_PlayChannel(i, samples[currentCrash], 0);
-                    break;
-                case 's': // hi-hat
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-                    Mix_PlayChannel(i, samples[currentHiHat], 0);
-                    break;
-                case 'q': // tom
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-                    Mix_PlayChannel(i, samples[currentTom], 0);
-                    break;
-                case 'e': // ride
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-                    Mix_PlayChannel(i, samples[currentRide], 0);
-                    break;
-                case 'x': // open hi-hat
-                    i = Mix_GroupAvailable(-1);
-                    Mix_Volume(i, 128);
-                    Mix_PlayChannel(i, samples[currentOpHat], 0);
-                    break;
-                case 'o': // output sample indexes
-                    std::cerr << "k " << currentKick << " s " << currentSnare << " hh "
-                              << currentHiHat << " c " << currentCrash << " t " << currentTom
-                              << " r " << currentRide << " oh " << currentOpHat << std::endl;
-                    break;
-                case 'r': // randomize samples
-                    currentKick = *select_randomly(kicks.begin(), kicks.end());
-                    currentSnare = *select_randomly(snares.begin(), snares.end());
-                    currentHiHat = *select_randomly(hihats.begin(), hihats.end());
-                    currentCrash = *select_randomly(crashes.begin(), crashes.end());
-                    currentTom = *select_randomly(toms.begin(), toms.end());
-                    currentRide = *select_randomly(rides.begin(), rides.end());
-                    currentOpHat = *select_randomly(ophats.begin(), ophats.end());
-                    break;
-                case 'p': // pause toggle
-                    beatPlaying = !beatPlaying;
-                    break;
-                case 'm': // increase the bpm
-                    bpm += 10.0;
-                    break;
-                case 'n': // decrease the bpm
-                    bpm -= 10.0;
-                    break;
-                case 'y': // use the current settings, don't change samples
-                    beatPlaying = true;
-                    useRandomBeatSkip = true;
-                    useRandomBeatSilence = true;
-                    useRandomSamples = false;
-                    break;
-                case 'i': // toggle "random beat skip"
-                    useRandomBeatSkip = !useRandomBeatSkip;
-                    break;
-                case 'j': // toggle "use random beat silence"
-                    useRandomBeatSilence = !useRandomBeatSilence;
-                    break;
-                case SDLK_ESCAPE: // quit
-                    done = true;
-                    break;
-                case SDLK_SPACE: // fade-out and then pause toggle
-                    // Fade out for 200 ms
-                    Mix_FadeOutChannel(-1, 200);
-                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                    // Pause toggle
-                    beatPlaying = !beatPlaying;
-                    break;
-                case 'v': // generate a sawtooth sound
-                {
-                    const double freq = *select_randomly(bassFrequencies.begin(), bassFrequencies.end());
-                    const int sampleRate = 44100;
-                    const int durationMs = 150;
-                    int16_t* waveData = generateSawtoothWave(freq * 2.0, sampleRate, durationMs);
-
-                    // Calculate the total bytes (16-bit samples)
-                    int byteLength = sampleRate * durationMs / 1000 * sizeof(int16_t);
-
-                    // Load the raw wave data into an SDL_Mixer chunk
-                    Mix_Chunk* waveChunk = Mix_QuickLoad_RAW((Uint8*)waveData, byteLength);
-                    if (!waveChunk) {
-                        std::cerr << "Failed to load sawtooth sample" << std::endl;
-                        delete[] waveData;
-                        break;
-                    }
-
-                    // Play the loaded sinus wave
-                    int channel = Mix_PlayChannel(-1, waveChunk, 0);
-                    if (channel == -1) {
-                        std::cerr << "Failed to play sawtooth sample" << std::endl;
-                    }
-
-                    // Clean up after the sound is done
-                    SDL_Delay(durationMs);
-                    Mix_FreeChunk(waveChunk);
-                    delete[] waveData;
-                } break;
-
-                case 'b': // play generated kick drum sound
-                {
-                    const int sampleRate = 44100;
-                    const int durationMs = 200;
-                    int16_t* drumData = generateKickDrum(sampleRate, durationMs);
-
-                    // Calculate the total bytes (16-bit samples)
-                    int byteLength = sampleRate * durationMs / 1000 * sizeof(int16_t);
-
-                    // Load the raw wave data into an SDL_Mixer chunk
-                    Mix_Chunk* drumChunk = Mix_QuickLoad_RAW((Uint8*)drumData, byteLength);
-                    if (!drumChunk) {
-                        std::cerr << "Failed to load kick drum sound" << std::endl;
-                        delete[] drumData;
-                        break;
-                    }
-
-                    // Play the loaded kick drum sound
-                    int channel = Mix_PlayChannel(-1, drumChunk, 0);
-                    if (channel == -1) {
-                        std::cerr << "Failed to play kick drum sound" << std::endl;
-                    }
-                    SDL_Delay(durationMs);
-                    Mix_FreeChunk(drumChunk);
-                    delete[] drumData;
-                } break;
-
-                default:
-                    break;
-                }
-                break;
-            case SDL_QUIT:
-                done = true;
-                break;
-            default:
-                break;
-            }
-
-            // This delay value gives close to 120 BPM, minus the time taken
-            // to call the Mix functions (which returns quickly).
-            // For beat stability, there should a time adjustment at every loop,
-            // or slightly less delay depending on how long calling the functions takes.
-
-            double bps = bpm / 60.0; // 2 beats per second
-            int dpb = static_cast<int>(1000000.0 / bps); // delay per beat
-
-            now = std::chrono::steady_clock::now();
-
-            auto r1 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX); // random number [0,1)
-            bool silenceBeat = useRandomBeatSilence && (r1 < randomChanceBeatSilence);
-
-            auto nsDuration = std::chrono::duration_cast<std::chrono::microseconds>(now - soundTime).count();
-
-            if (nsDuration > dpb && beatPlaying) {
-
-                soundTime = std::chrono::steady_clock::now();
-
-                if (!silenceBeat) {
-
-                    auto r2 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX); // random number [0,1)
-                    bool skipBeat = useRandomBeatSkip && (r2 < randomChanceBeatSkip);
-                    if (skipBeat) {
-                        beatCounter++;
-                        if (beatCounter >= maxBeatCounter) {
-                            beatCounter = 0;
-                        }
-                    }
-
-                    auto r3 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX); // random number [0,1)
-                    bool newSamplesNow = (r3 < randomChanceNewSamples);
-                    if (useRandomSamples && newSamplesNow) {
-                        currentKick = *select_randomly(kicks.begin(), kicks.end());
-                        currentSnare = *select_randomly(snares.begin(), snares.end());
-                        currentHiHat = *select_randomly(hihats.begin(), hihats.end());
-                        currentCrash = *select_randomly(crashes.begin(), crashes.end());
-                        currentTom = *select_randomly(toms.begin(), toms.end());
-                        currentRide = *select_randomly(rides.begin(), rides.end());
-                        currentOpHat = *select_randomly(ophats.begin(), ophats.end());
-                    }
-
-                    if (kPat.at(beatCounter) == 'k') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentKick], 0);
-                    }
-
-                    if (kPat.at(beatCounter) == 'K') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentKick], 0);
-
-                        // Create a new thread
-                        std::thread t([samples, currentKick]() {
-                            // This lambda function will run in a new thread
-                            // Sleep for 100 ms
-                            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                            int freeChannel2 = Mix_GroupAvailable(-1);
-                            Mix_Volume(freeChannel2, 128);
-                            Mix_PlayChannel(freeChannel2, samples[currentKick], 0);
-                        });
-                        // Detach the thread so that it can run independently from the main thread
-                        t.detach();
-                    }
-
-                    if (sPat.at(beatCounter) == 's') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentSnare], 0);
-                    }
-                    if (hPat.at(beatCounter) == 'h') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentHiHat], 0);
-                    }
-                    if (cPat.at(beatCounter) == 'c') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentCrash], 0);
-                    }
-                    if (tPat.at(beatCounter) == 't') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentTom], 0);
-                    }
-                    if (rPat.at(beatCounter) == 'r') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentRide], 0);
-                    }
-                    if (oPat.at(beatCounter) == 'o') {
-                        freeChannel = Mix_GroupAvailable(-1);
-                        Mix_Volume(freeChannel, 128);
-                        Mix_PlayChannel(freeChannel, samples[currentOpHat], 0);
-                    }
-
-                    beatCounter++;
-                    if (beatCounter >= maxBeatCounter) {
-                        beatCounter = 0;
-                    }
-
-                } // if not silencing this beat
-
-            } // if beatPlaying
-
-            if (!done) {
-                gotEvent = SDL_PollEvent(&Event);
-            }
-        }
-    }
-
-    // Free samples
-    for (size_t i = 0; i < samples.size(); ++i) {
-        Mix_FreeChunk((Mix_Chunk*)(samples[i]));
-    }
-
-    Mix_CloseAudio();
+    const int status = playMain(options, ren, tex);
 
     SDL_DestroyTexture(tex);
     SDL_DestroyRenderer(ren);
@@ -678,5 +809,5 @@ int main(int argc, char** argv)
 
     SDL_Quit();
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,477 @@
+#pragma once
+
+#include "categories.h"
+#include "mixer.h"
+#include "pattern.h"
+#include "tempo.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The drums are on channel 10, as in General MIDI, which is 9 when counting from 0
+const int midiDrumChannel = 9;
+
+// The resolution of the written files, in ticks per beat
+const int midiTicksPerBeat = 960;
+
+// How long the notes of the written files are. Drums ignore it, but some programs do not show notes without a length.
+const int midiNoteTicks = midiTicksPerBeat / 16;
+
+// The General MIDI note that each category is written as
+const std::array<uint8_t, categoryCount> midiDrumNotes = {
+    36, // kick: bass drum 1
+    38, // snare: acoustic snare
+    42, // hihat: closed hi-hat
+    49, // crash: crash cymbal 1
+    45, // tom: low tom
+    51, // ride: ride cymbal 1
+    46, // ophat: open hi-hat
+};
+
+// The category of a General MIDI drum note, if it is one of the drums that are played
+inline std::optional<Category> midiDrumCategory(int note)
+{
+    switch (note) {
+    case 35: // acoustic bass drum
+    case 36: // bass drum 1
+        return Category::Kick;
+    case 37: // side stick
+    case 38: // acoustic snare
+    case 39: // hand clap
+    case 40: // electric snare
+        return Category::Snare;
+    case 42: // closed hi-hat
+    case 44: // pedal hi-hat
+        return Category::HiHat;
+    case 46: // open hi-hat
+        return Category::OpHat;
+    case 49: // crash cymbal 1
+    case 52: // chinese cymbal
+    case 55: // splash cymbal
+    case 57: // crash cymbal 2
+        return Category::Crash;
+    case 41: // low floor tom
+    case 43: // high floor tom
+    case 45: // low tom
+    case 47: // low-mid tom
+    case 48: // hi-mid tom
+    case 50: // high tom
+        return Category::Tom;
+    case 51: // ride cymbal 1
+    case 53: // ride bell
+    case 59: // ride cymbal 2
+        return Category::Ride;
+    default:
+        return std::nullopt;
+    }
+}
+
+inline void appendBigEndian(std::string& out, uint32_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+// A variable length quantity, with 7 bits per byte, the most significant first
+inline void appendVariableLength(std::string& out, uint64_t value)
+{
+    char bytes[10];
+    int count = 0;
+    do {
+        bytes[count++] = static_cast<char>(value & 0x7f);
+        value >>= 7;
+    } while (value > 0);
+    while (count > 1) {
+        out.push_back(static_cast<char>(bytes[--count] | 0x80));
+    }
+    out.push_back(bytes[0]);
+}
+
+// MidiWriter collects hits, at frames of the output, and writes them as a Standard MIDI File with a
+// single track, with the drums on channel 10. The frames are converted to ticks with the tempo at
+// each frame, so that the hits that were played on a step fall on the beat grid of the file.
+// The hits and the tempo changes must be added in the order of their frames.
+class MidiWriter {
+public:
+    // Without a tempo change at the start, the file starts at the default tempo
+    MidiWriter()
+    {
+        noteOns.fill(noNote);
+        setTempo(0, Tempo {}.beatsPerMinute);
+    }
+
+    // From the given frame on, play at the given number of beats per minute
+    void setTempo(uint64_t frame, double beatsPerMinute)
+    {
+        const double tick = ticksAt(frame);
+        tempoFrame = frame;
+        tempoTick = tick;
+        microsecondsPerBeat = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(60000000.0 / beatsPerMinute)), 1, 0xffffff);
+        MidiEvent event { .tick = static_cast<uint64_t>(std::llround(tick)), .order = 1, .size = 6, .data = { 0xff, 0x51, 3 } };
+        event.data[3] = static_cast<uint8_t>(microsecondsPerBeat >> 16);
+        event.data[4] = static_cast<uint8_t>(microsecondsPerBeat >> 8);
+        event.data[5] = static_cast<uint8_t>(microsecondsPerBeat);
+        // Only the last of the tempo changes at a tick counts
+        if (lastTempo != noNote && events[lastTempo].tick == event.tick) {
+            events[lastTempo] = event;
+            return;
+        }
+        lastTempo = events.size();
+        events.push_back(event);
+    }
+
+    // Add a hit of a drum, at a volume from 0 to 128
+    void addHit(uint64_t frame, Category category, int volume)
+    {
+        if (volume <= 0) {
+            return;
+        }
+        const auto tick = static_cast<uint64_t>(std::llround(ticksAt(frame)));
+        const uint8_t note = midiDrumNotes[static_cast<int>(category)];
+        const auto velocity = static_cast<uint8_t>(std::clamp<long>(std::lround(volume * 127.0 / 128.0), 1, 127));
+        const uint8_t noteOn = 0x90 | midiDrumChannel;
+        if (noteOns[note] != noNote) {
+            auto& previous = events[noteOns[note]];
+            // Hits of the same drum at the same tick become one, at the loudest velocity
+            if (previous.tick == tick) {
+                previous.data[2] = std::max(previous.data[2], velocity);
+                return;
+            }
+            // A drum that is hit again is ended first
+            auto& previousOff = events[noteOns[note] + 1];
+            previousOff.tick = std::min(previousOff.tick, tick);
+        }
+        noteOns[note] = events.size();
+        events.push_back({ .tick = tick, .order = 2, .size = 3, .data = { noteOn, note, velocity } });
+        // A note on with a velocity of 0 ends the note, so that all the notes share the running status
+        events.push_back({ .tick = tick + midiNoteTicks, .order = 0, .size = 3, .data = { noteOn, note, 0 } });
+        hitCount++;
+    }
+
+    size_t hits() const { return hitCount; }
+
+    // The whole file
+    std::string bytes() const
+    {
+        auto sorted = events;
+        std::stable_sort(sorted.begin(), sorted.end(), [](MidiEvent const& a, MidiEvent const& b) {
+            return a.tick != b.tick ? a.tick < b.tick : a.order < b.order;
+        });
+
+        std::string track;
+        const std::string_view name = "autodrums";
+        track += std::string_view("\x00\xff\x03", 3);
+        appendVariableLength(track, name.size());
+        track += name;
+        uint64_t tick = 0;
+        uint8_t runningStatus = 0;
+        for (auto const& event : sorted) {
+            appendVariableLength(track, event.tick - tick);
+            tick = event.tick;
+            const bool meta = event.data[0] == 0xff;
+            const bool running = !meta && event.data[0] == runningStatus;
+            track.append(reinterpret_cast<const char*>(event.data.data()) + (running ? 1 : 0), event.size - (running ? 1 : 0));
+            // Meta events cancel the running status
+            runningStatus = meta ? 0 : event.data[0];
+        }
+        track += std::string_view("\x00\xff\x2f\x00", 4);
+
+        std::string file = "MThd";
+        appendBigEndian(file, 6, 4);
+        appendBigEndian(file, 0, 2); // a single track
+        appendBigEndian(file, 1, 2);
+        appendBigEndian(file, midiTicksPerBeat, 2);
+        file += "MTrk";
+        appendBigEndian(file, static_cast<uint32_t>(track.size()), 4);
+        return file + track;
+    }
+
+    bool write(std::string const& filename) const
+    {
+        std::ofstream out(filename, std::ios::binary);
+        const auto file = bytes();
+        out.write(file.data(), static_cast<std::streamsize>(file.size()));
+        return out.good();
+    }
+
+private:
+    struct MidiEvent {
+        uint64_t tick;
+        uint8_t order; // of the events at the same tick: note ends, tempo changes, then note starts
+        uint8_t size;
+        std::array<uint8_t, 6> data;
+    };
+
+    static constexpr size_t noNote = SIZE_MAX;
+
+    double ticksAt(uint64_t frame) const
+    {
+        const double seconds = (static_cast<double>(frame) - static_cast<double>(tempoFrame)) / outputSampleRate;
+        return tempoTick + seconds * 1000000.0 / microsecondsPerBeat * midiTicksPerBeat;
+    }
+
+    std::vector<MidiEvent> events;
+    std::array<size_t, 128> noteOns; // the last note on of each note, which is followed by its note off
+    size_t lastTempo = noNote;
+    size_t hitCount = 0;
+
+    // The tempo that is in use, and the frame and tick at which it started
+    uint32_t microsecondsPerBeat = static_cast<uint32_t>(std::lround(60000000.0 / Tempo {}.beatsPerMinute));
+    uint64_t tempoFrame = 0;
+    double tempoTick = 0.0;
+};
+
+// MidiReader reads the big endian numbers of a Standard MIDI File, and notes if it reads past the end
+class MidiReader {
+public:
+    explicit MidiReader(std::string_view bytes)
+        : data(bytes)
+    {
+    }
+
+    bool failed() const { return overrun; }
+
+    size_t position() const { return pos; }
+
+    uint8_t peek() const { return pos < data.size() ? static_cast<uint8_t>(data[pos]) : 0; }
+
+    uint32_t bigEndian(int bytes)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value = value << 8 | peek();
+            skip(1);
+        }
+        return value;
+    }
+
+    // At most four bytes, as in the standard
+    uint32_t variableLength()
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            const uint8_t b = peek();
+            skip(1);
+            value = value << 7 | (b & 0x7f);
+            if ((b & 0x80) == 0) {
+                return value;
+            }
+        }
+        overrun = true;
+        return 0;
+    }
+
+    std::string_view bytes(size_t count)
+    {
+        if (count > data.size() - std::min(pos, data.size())) {
+            overrun = true;
+            pos = data.size();
+            return {};
+        }
+        const auto result = data.substr(pos, count);
+        pos += count;
+        return result;
+    }
+
+    void skip(size_t count) { bytes(count); }
+
+private:
+    std::string_view data;
+    size_t pos = 0;
+    bool overrun = false;
+};
+
+// The drums of a Standard MIDI File, as a pattern with a track for each category
+struct MidiPattern {
+    std::vector<TrackSource> tracks;
+    size_t stepsPerBar = defaultStepsPerBar;
+    int stepsPerBeat = 4;
+    std::optional<double> beatsPerMinute; // if the file has a tempo
+};
+
+// Read the drum notes of a Standard MIDI File, of format 0 or 1. Only the notes on channel 10 are used,
+// if there are any, since that is where General MIDI puts the drums, and otherwise the notes of all
+// channels. The steps are the finest of 4 steps per beat, or the coarsest grid that fits all the notes
+// within a few ticks. If none fits, the notes are moved to the nearest sixteenth. The pattern lasts
+// until the end of the last track, in whole bars of the first time signature.
+// Returns nothing and sets the error message, if the file could not be read.
+inline std::optional<MidiPattern> parseMidiPattern(std::string_view data, std::string& error)
+{
+    struct Note {
+        uint64_t tick;
+        uint8_t channel;
+        Category category;
+        uint8_t velocity;
+    };
+
+    MidiReader in(data);
+    if (in.bytes(4) != "MThd") {
+        error = "not a MIDI file";
+        return std::nullopt;
+    }
+    const uint32_t headerBytes = in.bigEndian(4);
+    const uint32_t format = in.bigEndian(2);
+    const uint32_t trackCount = in.bigEndian(2);
+    const uint32_t division = in.bigEndian(2);
+    in.skip(headerBytes - std::min<uint32_t>(headerBytes, 6));
+    if (in.failed() || headerBytes < 6) {
+        error = "the MIDI file is truncated";
+        return std::nullopt;
+    }
+    if (format > 1) {
+        error = "only MIDI files of format 0 and 1 are supported";
+        return std::nullopt;
+    }
+    if (division == 0 || (division & 0x8000) != 0) {
+        error = "only MIDI files with ticks per beat are supported, not SMPTE time";
+        return std::nullopt;
+    }
+    const double ticksPerBeat = division;
+
+    std::vector<Note> notes;
+    std::optional<uint32_t> microsecondsPerBeat;
+    std::optional<double> beatsPerBar;
+    uint64_t endTick = 0;
+    bool drumChannel = false;
+    for (uint32_t t = 0; t < trackCount;) {
+        const auto chunkType = in.bytes(4);
+        const uint32_t chunkBytes = in.bigEndian(4);
+        MidiReader track(in.bytes(chunkBytes));
+        if (in.failed()) {
+            error = "the MIDI file is truncated";
+            return std::nullopt;
+        }
+        // Chunks of other types are skipped, as the standard asks
+        if (chunkType != "MTrk") {
+            continue;
+        }
+        uint64_t tick = 0;
+        uint8_t status = 0;
+        while (!track.failed() && track.position() < chunkBytes) {
+            tick += track.variableLength();
+            if ((track.peek() & 0x80) != 0) {
+                status = track.peek();
+                track.skip(1);
+            } else if (status == 0) {
+                error = "invalid MIDI event in track " + std::to_string(t + 1);
+                return std::nullopt;
+            }
+            if (status == 0xff) {
+                const uint8_t type = track.bigEndian(1);
+                const auto meta = track.bytes(track.variableLength());
+                if (type == 0x51 && meta.size() == 3 && !microsecondsPerBeat) {
+                    MidiReader value(meta);
+                    microsecondsPerBeat = value.bigEndian(3);
+                } else if (type == 0x58 && meta.size() >= 2 && !beatsPerBar) {
+                    // The numerator, and the denominator as a power of two
+                    MidiReader value(meta);
+                    const uint8_t numerator = value.bigEndian(1);
+                    const uint8_t denominator = value.bigEndian(1);
+                    if (numerator > 0 && denominator < 8) {
+                        beatsPerBar = numerator * 4.0 / (1 << denominator);
+                    }
+                } else if (type == 0x2f) {
+                    break;
+                }
+                status = 0;
+            } else if (status == 0xf0 || status == 0xf7) {
+                track.skip(track.variableLength());
+                status = 0;
+            } else {
+                const uint8_t kind = status & 0xf0;
+                const uint8_t channel = status & 0x0f;
+                const uint8_t note = track.bigEndian(1);
+                const uint8_t velocity = (kind == 0xc0 || kind == 0xd0) ? 0 : track.bigEndian(1);
+                const auto category = midiDrumCategory(note);
+                if (kind == 0x90 && velocity > 0 && category) {
+                    notes.push_back({ tick, channel, *category, velocity });
+                    drumChannel = drumChannel || channel == midiDrumChannel;
+                }
+            }
+        }
+        if (track.failed()) {
+            error = "track " + std::to_string(t + 1) + " of the MIDI file is truncated";
+            return std::nullopt;
+        }
+        endTick = std::max(endTick, tick);
+        ++t;
+    }
+    if (drumChannel) {
+        std::erase_if(notes, [](Note const& note) { return note.channel != midiDrumChannel; });
+    }
+    if (notes.empty()) {
+        error = "the MIDI file has no drum notes";
+        return std::nullopt;
+    }
+
+    // The grid that the notes are on
+    const double tolerance = std::max(1.0, ticksPerBeat / 240.0);
+    auto fits = [&](int stepsPerBeat) {
+        const double stepTicks = ticksPerBeat / stepsPerBeat;
+        return std::all_of(notes.begin(), notes.end(), [&](Note const& note) {
+            const double ticks = static_cast<double>(note.tick);
+            return std::abs(ticks - std::round(ticks / stepTicks) * stepTicks) <= tolerance;
+        });
+    };
+    MidiPattern pattern;
+    if (!fits(pattern.stepsPerBeat)) {
+        for (int s = 1; s <= maxStepsPerBeat; ++s) {
+            if (fits(s)) {
+                pattern.stepsPerBeat = s;
+                break;
+            }
+        }
+    }
+    const double stepTicks = ticksPerBeat / pattern.stepsPerBeat;
+    pattern.stepsPerBar = static_cast<size_t>(std::max(1L, std::lround(beatsPerBar.value_or(4.0) * pattern.stepsPerBeat)));
+    if (microsecondsPerBeat && *microsecondsPerBeat > 0) {
+        // The tempo is stored in whole microseconds per beat, which is rounded back to a thousandth of a beat per minute
+        const double beatsPerMinute = std::round(60000000000.0 / *microsecondsPerBeat) / 1000.0;
+        pattern.beatsPerMinute = std::clamp(beatsPerMinute, minBeatsPerMinute, maxBeatsPerMinute);
+    }
+
+    // Whole bars, up to the end of the last track, or to the last note
+    auto stepOf = [&](uint64_t tick) { return static_cast<size_t>(std::llround(static_cast<double>(tick) / stepTicks)); };
+    size_t length = stepOf(endTick);
+    for (auto const& note : notes) {
+        length = std::max(length, stepOf(note.tick) + 1);
+    }
+    length = (length + pattern.stepsPerBar - 1) / pattern.stepsPerBar * pattern.stepsPerBar;
+    if (length > maxPatternSteps) {
+        error = "the MIDI file is longer than " + std::to_string(maxPatternSteps) + " steps";
+        return std::nullopt;
+    }
+
+    // The loudest note of each category and step, as steps of a track. Full velocity is a letter, the rest are 1 to 9.
+    std::array<std::vector<uint8_t>, categoryCount> velocities;
+    for (auto const& note : notes) {
+        auto& track = velocities[static_cast<int>(note.category)];
+        track.resize(length);
+        const size_t step = stepOf(note.tick) % length;
+        track[step] = std::max(track[step], note.velocity);
+    }
+    for (int c = 0; c < categoryCount; ++c) {
+        if (velocities[c].empty()) {
+            continue;
+        }
+        TrackSource source { .category = static_cast<Category>(c), .steps = std::string(length, ' ') };
+        for (size_t s = 0; s < length; ++s) {
+            const int velocity = velocities[c][s];
+            if (velocity == 0) {
+                continue;
+            }
+            const long level = std::clamp(std::lround(velocity * 9.0 / 127.0), 1L, 9L);
+            source.steps[s] = level == 9 ? categoryNames[c][0] : static_cast<char>('0' + level);
+        }
+        pattern.tracks.push_back(std::move(source));
+    }
+    return pattern;
+}
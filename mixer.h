@@ -0,0 +1,231 @@
+#pragma once
+
+#include "effects.h"
+#include "simd.h"
+
+#include <SDL2/SDL_mixer.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// The output format that the audio device is opened with, and that all samples are converted to
+const int outputSampleRate = 44100;
+const int outputChannels = 2;
+static_assert(outputChannels == effectChannels, "the effects bus is stereo");
+const int outputBufferFrames = 512;
+
+// The number of voices that can play at the same time, unless another number is given to the Mixer
+const size_t defaultVoiceCount = 256;
+
+// Voices are summed in blocks of this many frames, in a float accumulator
+const int mixBlockFrames = 256;
+
+// A sample that is being played back
+struct Voice {
+    const int16_t* data = nullptr; // interleaved stereo frames
+    uint32_t frames = 0; // length of the sample, in frames
+    uint32_t position = 0; // frames played so far
+    float gain = 0.0f;
+    float echo = 0.0f; // how much of the voice also goes to the echo of the effects bus
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+// The AVX2 part of accumulateSamples. Returns how many samples were added.
+__attribute__((target("avx2"))) inline int accumulateSamplesAvx2(float* acc, const int16_t* src, int count, float gain)
+{
+    int i = 0;
+    const __m256 g = _mm256_set1_ps(gain);
+    for (; i + 8 <= count; i += 8) {
+        const __m128i s16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m256 s = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s16));
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(s, g)));
+    }
+    return i;
+}
+
+// The AVX2 part of addSaturated. Returns how many samples were added.
+__attribute__((target("avx2"))) inline int addSaturatedAvx2(int16_t* dst, const float* acc, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const __m256 lo = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(d))), _mm256_loadu_ps(acc + i));
+        const __m256 hi = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(d, 1))), _mm256_loadu_ps(acc + i + 8));
+        // packs works within 128-bit lanes, so the lanes have to be put back in order
+        const __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    return i;
+}
+#endif
+
+// Add the int16 samples, multiplied by the gain, to the float accumulator
+inline void accumulateSamples(float* acc, const int16_t* src, int count, float gain)
+{
+    int i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpuHasAvx2()) {
+        i = accumulateSamplesAvx2(acc, src, count, gain);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128 g = _mm_set1_ps(gain);
+    for (; i + 8 <= count; i += 8) {
+        const __m128i s16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        // Sign extend to 32 bits, by unpacking into the high halves and shifting down
+        const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16));
+        const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s16, s16), 16));
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(lo, g)));
+        _mm_storeu_ps(acc + i + 4, _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(hi, g)));
+    }
+#endif
+    for (; i < count; ++i) {
+        acc[i] += static_cast<float>(src[i]) * gain;
+    }
+}
+
+// Add the float accumulator to the int16 samples, with saturation
+inline void addSaturated(int16_t* dst, const float* acc, int count)
+{
+    int i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpuHasAvx2()) {
+        i = addSaturatedAvx2(dst, acc, count);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        const __m128 lo = _mm_add_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16)), _mm_loadu_ps(acc + i));
+        const __m128 hi = _mm_add_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16)), _mm_loadu_ps(acc + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+#endif
+    for (; i < count; ++i) {
+        const float s = static_cast<float>(dst[i]) + acc[i];
+        dst[i] = static_cast<int16_t>(std::clamp(std::nearbyint(s), -32768.0f, 32767.0f));
+    }
+}
+
+// Mixer sums the active voices into the output stream, one frame range at a time,
+// so that new voices can be started at any frame within a buffer. The voices are
+// accumulated as floats, with SSE2, or AVX2 if the CPU has it, go through the effects bus,
+// and are saturated once at the end. All memory is allocated up front, so that the
+// mixer can be used from the audio thread.
+class Mixer {
+public:
+    explicit Mixer(size_t voiceCount = defaultVoiceCount)
+        : voices(std::max<size_t>(voiceCount, 1))
+    {
+    }
+
+    // Start playing the given chunk, at a volume from 0 to 128, like Mix_Volume, times the given gain,
+    // and send the given part of it to the echo. If all voices are busy, the voice that is closest to
+    // the end of its sample is stolen.
+    bool play(const Mix_Chunk* chunk, int volume, float gain = 1.0f, float echo = 0.0f)
+    {
+        if (chunk == nullptr) {
+            return false;
+        }
+        Voice* voice = nullptr;
+        if (activeCount < voices.size()) {
+            voice = &voices[activeCount++];
+        } else {
+            voice = &*std::min_element(voices.begin(), voices.end(), [](const Voice& a, const Voice& b) {
+                return a.frames - a.position < b.frames - b.position;
+            });
+            stolenVoices++;
+        }
+        voice->data = reinterpret_cast<const int16_t*>(chunk->abuf);
+        voice->frames = chunk->alen / (outputChannels * sizeof(int16_t));
+        voice->position = 0;
+        voice->gain = static_cast<float>(volume) / 128.0f * gain;
+        voice->echo = echo;
+        return true;
+    }
+
+    // Fade out all playing voices over the given number of frames
+    void fadeOut(int frames)
+    {
+        fadeFrames = std::max(frames, 1);
+        fadeRemaining = fadeFrames;
+    }
+
+    // Add the active voices to the given interleaved stereo stream, with saturation
+    void mix(int16_t* stream, int frames)
+    {
+        for (int start = 0; start < frames; start += mixBlockFrames) {
+            mixBlock(stream + start * outputChannels, std::min(frames - start, mixBlockFrames));
+        }
+    }
+
+    size_t activeVoices() const { return activeCount; }
+
+    // The echo and the reverb, which are set up before mixing
+    EffectsBus& effects() { return bus; }
+
+    // The number of voices that have been cut off to make room for new ones
+    uint64_t stolenVoiceCount() const { return stolenVoices; }
+
+private:
+    void mixBlock(int16_t* stream, int frames)
+    {
+        // The effects keep ringing after the voices have ended
+        if (activeCount == 0 && !bus.ringing()) {
+            fadeRemaining = std::max(fadeRemaining - frames, 0);
+            return;
+        }
+        const int count = frames * outputChannels;
+        const bool input = activeCount > 0;
+        bool echoing = false;
+        std::fill(acc.begin(), acc.begin() + count, 0.0f);
+        for (size_t v = 0; v < activeCount;) {
+            auto& voice = voices[v];
+            const int n = std::min(frames, static_cast<int>(voice.frames - voice.position));
+            accumulateSamples(acc.data(), voice.data + voice.position * outputChannels, n * outputChannels, voice.gain);
+            if (voice.echo > 0.0f) {
+                if (!echoing) {
+                    std::fill(echoAcc.begin(), echoAcc.begin() + count, 0.0f);
+                    echoing = true;
+                }
+                accumulateSamples(echoAcc.data(), voice.data + voice.position * outputChannels, n * outputChannels, voice.gain * voice.echo);
+            }
+            voice.position += n;
+            if (voice.position >= voice.frames) {
+                // Keep the active voices at the front
+                voice = voices[--activeCount];
+                continue;
+            }
+            ++v;
+        }
+        if (fadeRemaining > 0) {
+            for (int i = 0; i < frames; ++i) {
+                const float gain = static_cast<float>(std::max(fadeRemaining - i, 0)) / static_cast<float>(fadeFrames);
+                for (int c = 0; c < outputChannels; ++c) {
+                    acc[i * outputChannels + c] *= gain;
+                    echoAcc[i * outputChannels + c] *= gain;
+                }
+            }
+            fadeRemaining -= frames;
+            if (fadeRemaining <= 0) {
+                // The fade is complete, stop all voices
+                fadeRemaining = 0;
+                activeCount = 0;
+            }
+        }
+        bus.process(acc.data(), echoing ? echoAcc.data() : nullptr, input, frames);
+        addSaturated(stream, acc.data(), count);
+    }
+
+    std::vector<Voice> voices; // the active voices come first
+    size_t activeCount = 0;
+    uint64_t stolenVoices = 0;
+    std::array<float, mixBlockFrames * outputChannels> acc {};
+    std::array<float, mixBlockFrames * outputChannels> echoAcc {}; // what goes to the echo
+    EffectsBus bus;
+    int fadeFrames = 1;
+    int fadeRemaining = 0;
+};
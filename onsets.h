@@ -0,0 +1,146 @@
+#pragma once
+
+#include "categories.h"
+#include "library.h"
+#include "mixer.h"
+#include "sequencer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// An onset index lists every hit of a render, at the exact frame it starts at, so that tools can slice
+// the output without analysing it. It is written as CSV if the filename ends with .csv, and otherwise
+// as a compact binary file with this layout:
+//
+//   OnsetIndexHeader
+//   OnsetRecord, for each hit, in the order they were played
+//   OnsetName, for each sample that was hit, in the order of the sample ids, followed by its filename
+//   without a terminating zero
+//
+// All numbers are in the native byte order.
+struct OnsetIndexHeader {
+    char magic[8];
+    uint32_t sampleRate;
+    uint32_t nameCount;
+    uint64_t onsetCount;
+};
+
+struct OnsetRecord {
+    uint64_t frame; // the frame of the output at which the sample starts
+    uint32_t sample;
+    uint32_t step; // the position in the pattern
+    float gain; // what the sample is multiplied by
+    int16_t track; // the pattern track, or -1 for hits that were not played by the pattern
+    uint16_t category;
+};
+
+struct OnsetName {
+    uint32_t sample;
+    uint32_t nameBytes;
+};
+
+const char onsetIndexMagic[8] = { 'A', 'D', 'O', 'N', 'S', 'E', 'T', '1' };
+
+// Quote a field of CSV, if it needs it
+inline std::string csvField(std::string const& text)
+{
+    if (text.find_first_of(",\"\n\r") == std::string::npos) {
+        return text;
+    }
+    std::string quoted = "\"";
+    for (char c : text) {
+        quoted += c;
+        if (c == '"') {
+            quoted += '"';
+        }
+    }
+    return quoted + "\"";
+}
+
+// OnsetIndexWriter writes the hits of a sequencer, which must be recording events, to an onset index
+class OnsetIndexWriter {
+public:
+    explicit OnsetIndexWriter(SampleLibrary const& sampleLibrary)
+        : library(sampleLibrary)
+    {
+    }
+
+    bool open(std::string const& filename)
+    {
+        csv = std::filesystem::path(filename).extension() == ".csv";
+        out.open(filename, std::ios::binary);
+        hitSamples.assign(library.size(), false);
+        onsets = 0;
+        if (csv) {
+            out << "frame,track,sample,gain,category,step,filename\n";
+        } else {
+            // The counts are filled in by finish
+            const OnsetIndexHeader header {};
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        return out.good();
+    }
+
+    // Add the event, if it is a hit
+    void add(SequencerEvent const& event)
+    {
+        if (event.type != SequencerEvent::Hit) {
+            return;
+        }
+        onsets++;
+        if (csv) {
+            out << event.frame << ',' << event.track << ',' << event.sample << ',' << event.gain << ','
+                << categoryNames[static_cast<int>(event.category)] << ',' << event.step << ','
+                << csvField(library.filename(event.sample)) << '\n';
+            return;
+        }
+        hitSamples[event.sample] = true;
+        const OnsetRecord record {
+            .frame = event.frame,
+            .sample = static_cast<uint32_t>(event.sample),
+            .step = event.step,
+            .gain = event.gain,
+            .track = static_cast<int16_t>(event.track),
+            .category = static_cast<uint16_t>(event.category),
+        };
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+
+    // Write the names of the samples and the header, and close the file
+    bool finish()
+    {
+        if (!csv) {
+            OnsetIndexHeader header {};
+            memcpy(header.magic, onsetIndexMagic, sizeof(onsetIndexMagic));
+            header.sampleRate = outputSampleRate;
+            header.onsetCount = onsets;
+            for (size_t i = 0; i < hitSamples.size(); ++i) {
+                if (!hitSamples[i]) {
+                    continue;
+                }
+                const auto& name = library.filename(static_cast<SampleIndex>(i));
+                const OnsetName entry { .sample = static_cast<uint32_t>(i), .nameBytes = static_cast<uint32_t>(name.size()) };
+                out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+                out.write(name.data(), entry.nameBytes);
+                header.nameCount++;
+            }
+            out.seekp(0);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        out.close();
+        return !out.fail();
+    }
+
+    uint64_t count() const { return onsets; }
+
+private:
+    SampleLibrary const& library;
+    std::ofstream out;
+    bool csv = false;
+    std::vector<bool> hitSamples; // the samples to write the names of
+    uint64_t onsets = 0;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Call fn(i) for every i in [0,count), on as many threads as there are cores.
+// The indices are handed out one at a time, so that uneven work is balanced.
+template <typename Fn>
+void parallelFor(size_t count, Fn fn)
+{
+    const size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < threadCount; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
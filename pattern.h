@@ -0,0 +1,200 @@
+#pragma once
+
+#include "categories.h"
+#include "mixer.h"
+
+#include <cctype>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// The largest number of tracks in a pattern, since there is one bit per track in the step masks
+const size_t maxPatternTracks = 64;
+
+// Tracks of different lengths are unrolled to the least common multiple of the lengths, up to this many steps
+const size_t maxPatternSteps = 65536;
+
+// A pattern starts at the first step of a bar, and changes of the pattern are applied at the start of a bar
+const size_t defaultStepsPerBar = 16;
+
+// The delay of the second hit of a double hit, like the double kick
+const uint32_t doubleHitFrames = outputSampleRate / 10;
+
+// The longest random delay of a hit, for humanizing the timing
+const double maxJitterMs = 100.0;
+
+// A track of a pattern, in text form, with one character per step:
+//   ' ', '.' or '-' is a rest
+//   a lowercase letter is a hit
+//   an uppercase letter is a hit, and the same hit again 100 ms later
+//   '1' to '9' is a hit, at 1/9 to 9/9 of the full volume
+// The chances, if given, have one character per step as well:
+//   '0' to '9' is a 0% to 90% chance that the step plays
+//   ' ', '.' or '-' means that the step always plays
+struct TrackSource {
+    Category category;
+    std::string steps;
+    std::string chances;
+    int minVelocity = 128; // the volume of each hit is picked from this range, out of 128, times the volume of the step
+    int maxVelocity = 128;
+    double jitterMs = 0.0; // each hit is delayed by a random time, up to this
+};
+
+// A drum that is played by a step. Without variation, the chance is 1, the volume range is
+// a single volume and there is no jitter, and no random numbers are needed to play it.
+struct PatternEvent {
+    Category category;
+    uint16_t track;
+    uint16_t volume; // from 0 to 128, the loudest the hit can be
+    uint32_t offset; // in frames, after the start of the step
+    float chance; // that the track plays on this step, which is the same for all the events of a track and a step
+    uint16_t minVolume; // the softest the hit can be
+    uint32_t jitterFrames; // the longest random delay of the hit
+};
+
+// The tracks that play on a step, and where its events are in the event table
+struct PatternStep {
+    uint64_t trackMask;
+    uint32_t firstEvent;
+    uint32_t eventCount;
+};
+
+// Pattern is a drum pattern, compiled to a table with the events of each step,
+// so that evaluating a step is a single lookup. Each track can have its own length,
+// the pattern then repeats after the least common multiple of the lengths.
+class Pattern {
+public:
+    // Compile the given tracks, or return nothing and set the error message
+    static std::optional<Pattern> compile(std::vector<TrackSource> const& tracks, size_t stepsPerBar, std::string& error)
+    {
+        if (stepsPerBar == 0) {
+            error = "a bar must have at least one step";
+            return std::nullopt;
+        }
+        if (tracks.empty()) {
+            error = "the pattern has no tracks";
+            return std::nullopt;
+        }
+        if (tracks.size() > maxPatternTracks) {
+            error = "the pattern has more than " + std::to_string(maxPatternTracks) + " tracks";
+            return std::nullopt;
+        }
+        size_t length = 1;
+        for (size_t t = 0; t < tracks.size(); ++t) {
+            const auto& steps = tracks[t].steps;
+            if (steps.empty()) {
+                error = "track " + std::to_string(t + 1) + " has no steps";
+                return std::nullopt;
+            }
+            for (char c : steps) {
+                if (!isRest(c) && !std::isalpha(static_cast<unsigned char>(c)) && !(c >= '1' && c <= '9')) {
+                    error = "track " + std::to_string(t + 1) + " has an invalid step: '" + std::string(1, c) + "'";
+                    return std::nullopt;
+                }
+            }
+            const auto& chances = tracks[t].chances;
+            if (!chances.empty() && chances.size() != steps.size()) {
+                error = "track " + std::to_string(t + 1) + " has " + std::to_string(chances.size()) + " chances for "
+                    + std::to_string(steps.size()) + " steps";
+                return std::nullopt;
+            }
+            for (char c : chances) {
+                if (!isRest(c) && !(c >= '0' && c <= '9')) {
+                    error = "track " + std::to_string(t + 1) + " has an invalid chance: '" + std::string(1, c) + "'";
+                    return std::nullopt;
+                }
+            }
+            if (tracks[t].minVelocity < 0 || tracks[t].minVelocity > tracks[t].maxVelocity || tracks[t].maxVelocity > 128) {
+                error = "track " + std::to_string(t + 1) + " has an invalid velocity range";
+                return std::nullopt;
+            }
+            if (!(tracks[t].jitterMs >= 0.0 && tracks[t].jitterMs <= maxJitterMs)) {
+                error = "track " + std::to_string(t + 1) + " has an invalid jitter";
+                return std::nullopt;
+            }
+            length = std::lcm(length, steps.size());
+            if (length > maxPatternSteps) {
+                error = "the track lengths repeat after more than " + std::to_string(maxPatternSteps) + " steps";
+                return std::nullopt;
+            }
+        }
+
+        Pattern pattern;
+        pattern.trackCount = tracks.size();
+        pattern.barLength = stepsPerBar;
+        pattern.steps.resize(length);
+        for (size_t s = 0; s < length; ++s) {
+            auto& step = pattern.steps[s];
+            step = { 0, static_cast<uint32_t>(pattern.eventTable.size()), 0 };
+            for (size_t t = 0; t < tracks.size(); ++t) {
+                const auto& source = tracks[t];
+                const size_t position = s % source.steps.size();
+                const char c = source.steps[position];
+                if (isRest(c)) {
+                    continue;
+                }
+                const int stepVolume = (c >= '1' && c <= '9') ? (c - '0') * 128 / 9 : 128;
+                PatternEvent event;
+                event.category = source.category;
+                event.track = static_cast<uint16_t>(t);
+                event.volume = static_cast<uint16_t>(stepVolume * source.maxVelocity / 128);
+                event.offset = 0;
+                const char chance = source.chances.empty() ? ' ' : source.chances[position];
+                event.chance = isRest(chance) ? 1.0f : static_cast<float>(chance - '0') / 10.0f;
+                event.minVolume = static_cast<uint16_t>(stepVolume * source.minVelocity / 128);
+                event.jitterFrames = static_cast<uint32_t>(source.jitterMs * outputSampleRate / 1000.0);
+                pattern.eventTable.push_back(event);
+                if (std::isupper(static_cast<unsigned char>(c))) {
+                    event.offset = doubleHitFrames;
+                    pattern.eventTable.push_back(event);
+                }
+                step.trackMask |= uint64_t { 1 } << t;
+            }
+            step.eventCount = static_cast<uint32_t>(pattern.eventTable.size()) - step.firstEvent;
+        }
+        return pattern;
+    }
+
+    size_t length() const { return steps.size(); }
+
+    size_t tracks() const { return trackCount; }
+
+    size_t stepsPerBar() const { return barLength; }
+
+    // The tracks that play on the given step, one bit per track
+    uint64_t trackMask(size_t step) const { return steps[step].trackMask; }
+
+    // The drums to play on the given step, in track order
+    std::span<const PatternEvent> events(size_t step) const
+    {
+        const auto& s = steps[step];
+        return { eventTable.data() + s.firstEvent, s.eventCount };
+    }
+
+private:
+    static bool isRest(char c) { return c == ' ' || c == '.' || c == '-'; }
+
+    size_t trackCount = 0;
+    size_t barLength = defaultStepsPerBar;
+    std::vector<PatternStep> steps;
+    std::vector<PatternEvent> eventTable;
+};
+
+// The initial drum pattern
+inline Pattern defaultPattern()
+{
+    const std::vector<TrackSource> tracks = {
+        { Category::Kick, "k   k   Kk  k   " }, // k for kick, K for double kick
+        { Category::Snare, "  s           s " }, // s for snare
+        { Category::HiHat, " h h hhh  hh h h" }, // h for hihat
+        { Category::Crash, "        c       " }, // c for crash
+        { Category::Tom, "t               " }, // t for tom
+        { Category::Ride, "  r             " }, // r for ride
+        { Category::OpHat, "    o           " }, // o for open hihat
+    };
+    std::string error;
+    return *Pattern::compile(tracks, defaultStepsPerBar, error);
+}
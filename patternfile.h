@@ -0,0 +1,349 @@
+#pragma once
+
+#include "categories.h"
+#include "midi.h"
+#include "pattern.h"
+#include "tempo.h"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <optional>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// The settings that can be given in a pattern file. The settings that are not
+// in the file are left as they are, except for the pattern, which is required.
+struct PatternSettings {
+    Pattern pattern;
+    std::optional<double> tempo; // in beats per minute
+    std::optional<int> stepsPerBeat;
+    std::optional<double> swing;
+    std::optional<bool> randomBeatSkip;
+    std::optional<bool> randomBeatSilence;
+    std::optional<bool> randomSamples;
+    std::optional<double> chanceBeatSkip;
+    std::optional<double> chanceBeatSilence;
+    std::optional<double> chanceNewSamples;
+    std::array<std::optional<std::string>, categoryCount> kitSamples; // the sample filenames
+};
+
+// Parse a pattern file. A pattern file has one setting or track per line:
+//
+//   # a comment
+//   tempo 125
+//   beat 4
+//   swing 0.2
+//   bar 16
+//   randomskip on
+//   skipchance 0.6
+//   randomsilence on
+//   silencechance 0.005
+//   randomsamples off
+//   newsampleschance 0.01
+//   kit kick Kicks/kick01.wav
+//   kick  |k   k   Kk  k   |
+//   snare |  s           s |
+//   hihat | h h hhh  hh h h|
+//   chance| 9 5 959  95 9 5|
+//   velocity 80 128
+//   jitter 5
+//
+// A track is a category name, followed by the steps between the first and the last '|'.
+// A '|' within the steps is skipped, so that the bars can be marked. See TrackSource for the steps.
+// The chance, velocity and jitter lines change the track above them: the chance that each step
+// plays, the range of the volume out of 128, and the longest random delay of each hit, in milliseconds.
+// Returns nothing and sets the error message, if the file could not be parsed.
+inline std::optional<PatternSettings> parsePatternFile(std::istream& in, std::string const& name, std::string& error)
+{
+    PatternSettings settings;
+    std::vector<TrackSource> tracks;
+    size_t stepsPerBar = defaultStepsPerBar;
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+        auto fail = [&](std::string const& message) {
+            error = name + ":" + std::to_string(lineNumber) + ": " + message;
+            return std::nullopt;
+        };
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+        // The steps of a track may follow the category name without a space
+        keyword = keyword.substr(0, keyword.find('|'));
+
+        std::optional<Category> category;
+        for (int c = 0; c < categoryCount; ++c) {
+            if (keyword == categoryNames[c]) {
+                category = static_cast<Category>(c);
+            }
+        }
+        // The characters between the first and the last '|', without the ones in between
+        auto stepsOf = [&line]() -> std::optional<std::string> {
+            const auto first = line.find('|');
+            const auto last = line.rfind('|');
+            if (first == std::string::npos || first == last) {
+                return std::nullopt;
+            }
+            std::string steps;
+            for (auto i = first + 1; i < last; ++i) {
+                if (line[i] != '|') {
+                    steps.push_back(line[i]);
+                }
+            }
+            return steps;
+        };
+        if (category) {
+            auto steps = stepsOf();
+            if (!steps) {
+                return fail("the steps of a track must be between two '|'");
+            }
+            tracks.push_back({ *category, std::move(*steps) });
+            continue;
+        }
+        if ((keyword == "chance" || keyword == "velocity" || keyword == "jitter") && tracks.empty()) {
+            return fail(keyword + " must follow a track");
+        }
+        if (keyword == "chance") {
+            auto chances = stepsOf();
+            if (!chances) {
+                return fail("the chances of a track must be between two '|'");
+            }
+            tracks.back().chances = std::move(*chances);
+            continue;
+        }
+
+        std::string value;
+        if (!(words >> value)) {
+            return fail("missing value for " + keyword);
+        }
+        auto number = [&](double low, double high) -> std::optional<double> {
+            char* end = nullptr;
+            const double x = std::strtod(value.c_str(), &end);
+            if (end == value.c_str() || *end != '\0' || !(x >= low && x <= high)) {
+                return std::nullopt;
+            }
+            return x;
+        };
+        auto wholeNumber = [&](int low, int high) -> std::optional<int> {
+            const auto x = number(low, high);
+            if (!x || *x != std::floor(*x)) {
+                return std::nullopt;
+            }
+            return static_cast<int>(*x);
+        };
+        auto flag = [&]() -> std::optional<bool> {
+            if (value == "on") {
+                return true;
+            }
+            if (value == "off") {
+                return false;
+            }
+            return std::nullopt;
+        };
+        if (keyword == "tempo") {
+            if (!(settings.tempo = number(minBeatsPerMinute, maxBeatsPerMinute))) {
+                return fail("the tempo must be from " + std::to_string(static_cast<int>(minBeatsPerMinute)) + " to "
+                    + std::to_string(static_cast<int>(maxBeatsPerMinute)) + " beats per minute");
+            }
+        } else if (keyword == "beat") {
+            const auto steps = wholeNumber(1, maxStepsPerBeat);
+            if (!steps) {
+                return fail("the number of steps per beat must be a whole number from 1 to " + std::to_string(maxStepsPerBeat));
+            }
+            settings.stepsPerBeat = *steps;
+        } else if (keyword == "swing") {
+            if (!(settings.swing = number(0.0, maxSwing))) {
+                return fail("swing must be from 0 to 0.5");
+            }
+        } else if (keyword == "bar") {
+            const auto steps = wholeNumber(1, static_cast<int>(maxPatternSteps));
+            if (!steps) {
+                return fail("the number of steps per bar must be a whole number from 1 to " + std::to_string(maxPatternSteps));
+            }
+            stepsPerBar = static_cast<size_t>(*steps);
+        } else if (keyword == "randomskip") {
+            if (!(settings.randomBeatSkip = flag())) {
+                return fail("randomskip must be on or off");
+            }
+        } else if (keyword == "randomsilence") {
+            if (!(settings.randomBeatSilence = flag())) {
+                return fail("randomsilence must be on or off");
+            }
+        } else if (keyword == "randomsamples") {
+            if (!(settings.randomSamples = flag())) {
+                return fail("randomsamples must be on or off");
+            }
+        } else if (keyword == "skipchance") {
+            if (!(settings.chanceBeatSkip = number(0.0, 1.0))) {
+                return fail("skipchance must be from 0 to 1");
+            }
+        } else if (keyword == "silencechance") {
+            if (!(settings.chanceBeatSilence = number(0.0, 1.0))) {
+                return fail("silencechance must be from 0 to 1");
+            }
+        } else if (keyword == "newsampleschance") {
+            if (!(settings.chanceNewSamples = number(0.0, 1.0))) {
+                return fail("newsampleschance must be from 0 to 1");
+            }
+        } else if (keyword == "velocity") {
+            const auto low = number(0.0, 128.0);
+            value.clear();
+            words >> value;
+            const auto high = number(0.0, 128.0);
+            if (!low || !high || *low > *high) {
+                return fail("velocity must be a range from 0 to 128, like: velocity 80 128");
+            }
+            tracks.back().minVelocity = static_cast<int>(*low);
+            tracks.back().maxVelocity = static_cast<int>(*high);
+        } else if (keyword == "jitter") {
+            if (auto jitter = number(0.0, maxJitterMs)) {
+                tracks.back().jitterMs = *jitter;
+            } else {
+                return fail("jitter must be from 0 to " + std::to_string(static_cast<int>(maxJitterMs)) + " milliseconds");
+            }
+        } else if (keyword == "kit") {
+            std::optional<Category> kitCategory;
+            for (int c = 0; c < categoryCount; ++c) {
+                if (value == categoryNames[c]) {
+                    kitCategory = static_cast<Category>(c);
+                }
+            }
+            std::string filename;
+            std::getline(words >> std::ws, filename);
+            if (!kitCategory || filename.empty()) {
+                return fail("a kit line must have a category and a sample filename");
+            }
+            settings.kitSamples[static_cast<int>(*kitCategory)] = filename;
+        } else {
+            return fail("unknown setting: " + keyword);
+        }
+    }
+
+    std::string patternError;
+    auto pattern = Pattern::compile(tracks, stepsPerBar, patternError);
+    if (!pattern) {
+        error = name + ": " + patternError;
+        return std::nullopt;
+    }
+    settings.pattern = std::move(*pattern);
+    return settings;
+}
+
+// Read the drums of a Standard MIDI File as a pattern, see parseMidiPattern. The file lists exactly
+// the hits to play, so the random skips and silences are turned off, and the tempo comes from the file.
+inline std::optional<PatternSettings> parseMidiPatternFile(std::string_view data, std::string const& name, std::string& error)
+{
+    auto midi = parseMidiPattern(data, error);
+    if (!midi) {
+        error = name + ": " + error;
+        return std::nullopt;
+    }
+    PatternSettings settings;
+    settings.tempo = midi->beatsPerMinute;
+    settings.stepsPerBeat = midi->stepsPerBeat;
+    settings.swing = 0.0;
+    settings.randomBeatSkip = false;
+    settings.randomBeatSilence = false;
+    std::string patternError;
+    auto pattern = Pattern::compile(midi->tracks, midi->stepsPerBar, patternError);
+    if (!pattern) {
+        error = name + ": " + patternError;
+        return std::nullopt;
+    }
+    settings.pattern = std::move(*pattern);
+    return settings;
+}
+
+// Load a pattern file, or a Standard MIDI File if the filename ends with .mid or .midi
+inline std::optional<PatternSettings> loadPatternFile(std::filesystem::path const& filename, std::string& error)
+{
+    const bool midi = filename.extension() == ".mid" || filename.extension() == ".midi";
+    std::ifstream in(filename, midi ? std::ios::binary : std::ios::in);
+    if (!in) {
+        error = "could not read " + filename.string();
+        return std::nullopt;
+    }
+    if (midi) {
+        const std::string data { std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+        return parseMidiPatternFile(data, filename.string(), error);
+    }
+    return parsePatternFile(in, filename.string(), error);
+}
+
+// FileWatcher calls a function, on its own thread, whenever the given file has been written
+// or replaced. The directory is watched, so that editors that save by renaming are noticed.
+class FileWatcher {
+public:
+    ~FileWatcher() { stop(); }
+
+    bool start(std::filesystem::path const& filename, std::function<void()> changed)
+    {
+        stop();
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        const auto directory = filename.has_parent_path() ? filename.parent_path() : std::filesystem::path(".");
+        if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        running = true;
+        thread = std::thread([this, name = filename.filename().string(), changed = std::move(changed)]() {
+            alignas(inotify_event) char buffer[4096];
+            while (running) {
+                // Wake up now and then, to see if the watcher should stop
+                pollfd p { fd, POLLIN, 0 };
+                if (poll(&p, 1, 200) <= 0) {
+                    continue;
+                }
+                bool found = false;
+                for (ssize_t length; (length = read(fd, buffer, sizeof(buffer))) > 0;) {
+                    for (ssize_t offset = 0; offset < length;) {
+                        const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                        if (event->len > 0 && name == event->name) {
+                            found = true;
+                        }
+                        offset += sizeof(inotify_event) + event->len;
+                    }
+                }
+                if (found) {
+                    changed();
+                }
+            }
+        });
+        return true;
+    }
+
+    void stop()
+    {
+        running = false;
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+private:
+    int fd = -1;
+    std::atomic<bool> running { false };
+    std::thread thread;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "mixer.h"
+#include "onsets.h"
+#include "sequencer.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// The number of frames that are rendered at a time, when rendering offline
+const int renderBlockFrames = 4096;
+
+// The number of frames that are rendered at a time, when the hits are also written to an onset index or
+// a MIDI file. The hits are read after each block, so the blocks are short enough that the events never overflow.
+const int recordingRenderBlockFrames = 256;
+
+template <typename T>
+inline void writeLittleEndian(std::ostream& out, T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+// Write a 44 byte WAV header for 16-bit PCM, in the output format unless another one is given.
+// The sizes saturate at 4 GiB, which is the limit of the WAV format.
+inline void writeWavHeader(std::ostream& out, uint64_t frames, int channels = outputChannels, int sampleRate = outputSampleRate)
+{
+    const uint32_t blockAlign = channels * sizeof(int16_t);
+    const uint64_t dataSize = std::min<uint64_t>(frames * blockAlign, std::numeric_limits<uint32_t>::max() - 36);
+    out.write("RIFF", 4);
+    writeLittleEndian<uint32_t>(out, static_cast<uint32_t>(36 + dataSize));
+    out.write("WAVE", 4);
+    out.write("fmt ", 4);
+    writeLittleEndian<uint32_t>(out, 16); // size of the fmt chunk
+    writeLittleEndian<uint16_t>(out, 1); // PCM
+    writeLittleEndian<uint16_t>(out, static_cast<uint16_t>(channels));
+    writeLittleEndian<uint32_t>(out, sampleRate);
+    writeLittleEndian<uint32_t>(out, sampleRate * blockAlign); // bytes per second
+    writeLittleEndian<uint16_t>(out, blockAlign);
+    writeLittleEndian<uint16_t>(out, 16); // bits per sample
+    out.write("data", 4);
+    writeLittleEndian<uint32_t>(out, static_cast<uint32_t>(dataSize));
+}
+
+// The filename of render i of a batch of count renders: "drums.wav" becomes "drums-07.wav",
+// with the index padded to the same width for all the renders
+inline std::string batchFilename(std::string const& filename, size_t i, size_t count)
+{
+    const std::filesystem::path path(filename);
+    const size_t width = std::to_string(count > 0 ? count - 1 : 0).size();
+    std::string number = std::to_string(i);
+    number.insert(0, width - std::min(width, number.size()), '0');
+    auto name = path;
+    name.replace_filename(path.stem().string() + "-" + number + path.extension().string());
+    return name.string();
+}
+
+// Render the given number of seconds of drums, as fast as possible, without using the audio device.
+// A WAV file is written if the filename ends with .wav, if not, raw interleaved S16 PCM is written.
+// If onsets or midi are given, the hits are added to them, and the sequencer must be recording events.
+inline bool renderToFile(Sequencer& sequencer, double seconds, const std::string& filename, OnsetIndexWriter* onsets = nullptr, MidiWriter* midi = nullptr)
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    const auto totalFrames = static_cast<uint64_t>(seconds * outputSampleRate);
+    if (std::filesystem::path(filename).extension() == ".wav") {
+        writeWavHeader(out, totalFrames);
+    }
+    // The samples are in the native byte order (AUDIO_S16SYS), which is little endian on all supported platforms
+    const bool recording = onsets != nullptr || midi != nullptr;
+    const int blockFrames = recording ? recordingRenderBlockFrames : renderBlockFrames;
+    std::vector<int16_t> buffer(blockFrames * outputChannels);
+    const uint64_t droppedBefore = loadRelaxed(sequencer.statistics().droppedEvents);
+    for (uint64_t rendered = 0; rendered < totalFrames;) {
+        const int n = static_cast<int>(std::min<uint64_t>(blockFrames, totalFrames - rendered));
+        std::fill(buffer.begin(), buffer.end(), 0);
+        sequencer.render(buffer.data(), n);
+        out.write(reinterpret_cast<const char*>(buffer.data()), n * outputChannels * sizeof(int16_t));
+        for (SequencerEvent event; recording && sequencer.nextEvent(event);) {
+            if (onsets != nullptr) {
+                onsets->add(event);
+            }
+            if (midi != nullptr) {
+                addMidiEvent(*midi, event);
+            }
+        }
+        rendered += n;
+    }
+    // An index or a MIDI file with missing hits would be wrong, not just incomplete
+    if (recording && loadRelaxed(sequencer.statistics().droppedEvents) != droppedBefore) {
+        return false;
+    }
+    return out.good();
+}
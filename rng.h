@@ -0,0 +1,249 @@
+#pragma once
+
+#include "simd.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+
+// Rng is a seedable xoshiro256** pseudo random number generator.
+// The output only depends on the seed, so that a run can be replayed exactly,
+// and each sequencer can have its own generator instead of sharing global state.
+// See https://prng.di.unimi.it/ for the algorithm.
+class Rng {
+public:
+    using result_type = uint64_t;
+
+    explicit Rng(uint64_t seedValue = 0) { seed(seedValue); }
+
+    // Initialize the state from a single 64-bit seed, by using splitmix64
+    void seed(uint64_t seedValue)
+    {
+        for (auto& word : s) {
+            seedValue += 0x9e3779b97f4a7c15;
+            uint64_t z = seedValue;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()()
+    {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Random number [0,1)
+    double uniform() { return static_cast<double>((*this)() >> 11) * 0x1.0p-53; }
+
+    // Random number [0,n), n must be larger than 0
+    uint64_t below(uint64_t n)
+    {
+        // Reject the lowest values, so that the modulo is not biased
+        const uint64_t threshold = -n % n;
+        for (;;) {
+            const uint64_t r = (*this)();
+            if (r >= threshold) {
+                return r % n;
+            }
+        }
+    }
+
+    // Advance the state by 2^128 steps. Can be used to create non-overlapping
+    // streams from a single seed, for generating in parallel.
+    void jump()
+    {
+        static const uint64_t jumpTable[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+        uint64_t t[4] = { 0, 0, 0, 0 };
+        for (auto jumpWord : jumpTable) {
+            for (int b = 0; b < 64; ++b) {
+                if (jumpWord & (uint64_t { 1 } << b)) {
+                    for (int i = 0; i < 4; ++i) {
+                        t[i] ^= s[i];
+                    }
+                }
+                (*this)();
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            s[i] = t[i];
+        }
+    }
+
+    // The four words of the state, for generators that step several states side by side
+    uint64_t state(int i) const { return s[i]; }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64_t s[4];
+};
+
+// RngBatch makes uniform random floats in [0,1) a batch at a time, from four xoshiro256** generators
+// that are stepped side by side, with SSE2 or AVX2 when the CPU has them. Each generator is a jump further along
+// the stream of the given generator, so the four never overlap with it or with each other.
+class RngBatch {
+public:
+    static const size_t lanes = 4;
+    static const size_t batchSize = 256;
+
+    explicit RngBatch(Rng start)
+    {
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            start.jump();
+            for (int w = 0; w < 4; ++w) {
+                s[w][lane] = start.state(w);
+            }
+        }
+        refill();
+    }
+
+    float next()
+    {
+        const float value = values[position];
+        if (++position == batchSize) {
+            refill();
+        }
+        return value;
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    // Keep the top 24 bits, which is all that a float has room for
+    static constexpr float floatScale = 0x1.0p-24f;
+
+    void refill()
+    {
+        size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+        if (cpuHasAvx2()) {
+            i = refillAvx2();
+        }
+#endif
+#if defined(__SSE2__)
+        if (i == 0) {
+            i = refillSse2();
+        }
+#endif
+        // Without SIMD, one lane at a time, since the state of all four does not fit in the registers
+        for (size_t lane = 0; lane < lanes && i < batchSize; ++lane) {
+            uint64_t s0 = s[0][lane], s1 = s[1][lane], s2 = s[2][lane], s3 = s[3][lane];
+            for (size_t j = i + lane; j < batchSize; j += lanes) {
+                const uint64_t result = rotl(s1 * 5, 7) * 9;
+                const uint64_t t = s1 << 17;
+                s2 ^= s0;
+                s3 ^= s1;
+                s1 ^= s2;
+                s0 ^= s3;
+                s2 ^= t;
+                s3 = rotl(s3, 45);
+                values[j] = static_cast<float>(static_cast<int32_t>(result >> 40)) * floatScale;
+            }
+            s[0][lane] = s0;
+            s[1][lane] = s1;
+            s[2][lane] = s2;
+            s[3][lane] = s3;
+        }
+        position = 0;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Lambdas do not inherit the target of the function they are in, so the helpers are functions of their own
+    __attribute__((target("avx2"))) static __m256i rotl256(__m256i x, int k) { return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k)); }
+
+    // All four lanes in one register. Returns how many values were made.
+    __attribute__((target("avx2"))) size_t refillAvx2()
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s[0].data()));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s[1].data()));
+        __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s[2].data()));
+        __m256i v3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s[3].data()));
+        // The multiplications by 5 and 9 are shifts and adds, since AVX2 has no 64-bit multiply
+        const __m256i evenLanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        const __m128 scale = _mm_set1_ps(floatScale);
+        for (size_t i = 0; i < batchSize; i += lanes) {
+            const __m256i times5 = _mm256_add_epi64(_mm256_slli_epi64(v1, 2), v1);
+            const __m256i r = rotl256(times5, 7);
+            const __m256i result = _mm256_add_epi64(_mm256_slli_epi64(r, 3), r);
+            const __m256i t = _mm256_slli_epi64(v1, 17);
+            v2 = _mm256_xor_si256(v2, v0);
+            v3 = _mm256_xor_si256(v3, v1);
+            v1 = _mm256_xor_si256(v1, v2);
+            v0 = _mm256_xor_si256(v0, v3);
+            v2 = _mm256_xor_si256(v2, t);
+            v3 = rotl256(v3, 45);
+            // The top 24 bits fit in the low half of each lane, gather those and convert them
+            const __m256i top = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(result, 40), evenLanes);
+            _mm_storeu_ps(values.data() + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm256_castsi256_si128(top)), scale));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(s[0].data()), v0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(s[1].data()), v1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(s[2].data()), v2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(s[3].data()), v3);
+        return batchSize;
+    }
+#endif
+
+#if defined(__SSE2__)
+    // Two lanes per register, so the state of all four takes eight of them. Returns how many values were made.
+    size_t refillSse2()
+    {
+        auto load = [this](int w, size_t lane) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(s[w].data() + lane)); };
+        auto store = [this](int w, size_t lane, __m128i x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(s[w].data() + lane), x); };
+        auto rotl128 = [](__m128i x, int k) { return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k)); };
+        // The multiplications by 5 and 9 are shifts and adds, since SSE2 has no 64-bit multiply
+        auto step = [rotl128](__m128i& s0, __m128i& s1, __m128i& s2, __m128i& s3) {
+            const __m128i times5 = _mm_add_epi64(_mm_slli_epi64(s1, 2), s1);
+            const __m128i r = rotl128(times5, 7);
+            const __m128i result = _mm_add_epi64(_mm_slli_epi64(r, 3), r);
+            const __m128i t = _mm_slli_epi64(s1, 17);
+            s2 = _mm_xor_si128(s2, s0);
+            s3 = _mm_xor_si128(s3, s1);
+            s1 = _mm_xor_si128(s1, s2);
+            s0 = _mm_xor_si128(s0, s3);
+            s2 = _mm_xor_si128(s2, t);
+            s3 = rotl128(s3, 45);
+            return _mm_srli_epi64(result, 40);
+        };
+        __m128i a0 = load(0, 0), a1 = load(1, 0), a2 = load(2, 0), a3 = load(3, 0);
+        __m128i b0 = load(0, 2), b1 = load(1, 2), b2 = load(2, 2), b3 = load(3, 2);
+        const __m128 scale = _mm_set1_ps(floatScale);
+        for (size_t i = 0; i < batchSize; i += lanes) {
+            const __m128i topA = step(a0, a1, a2, a3);
+            const __m128i topB = step(b0, b1, b2, b3);
+            // The top 24 bits are in the low half of each lane, gather those and convert them
+            const __m128 top = _mm_shuffle_ps(_mm_castsi128_ps(topA), _mm_castsi128_ps(topB), _MM_SHUFFLE(2, 0, 2, 0));
+            _mm_storeu_ps(values.data() + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(top)), scale));
+        }
+        store(0, 0, a0), store(1, 0, a1), store(2, 0, a2), store(3, 0, a3);
+        store(0, 2, b0), store(1, 2, b1), store(2, 2, b2), store(3, 2, b3);
+        return batchSize;
+    }
+#endif
+
+    std::array<std::array<uint64_t, lanes>, 4> s {}; // word, lane
+    std::array<float, batchSize> values {};
+    size_t position = 0;
+};
+
+// Select a random element in the range [start,end), which must not be empty
+template <typename Iter>
+Iter select_randomly(Iter start, Iter end, Rng& rng)
+{
+    std::advance(start, rng.below(static_cast<uint64_t>(std::distance(start, end))));
+    return start;
+}
@@ -0,0 +1,663 @@
+#pragma once
+
+#include "categories.h"
+#include "kit.h"
+#include "library.h"
+#include "midi.h"
+#include "mixer.h"
+#include "pattern.h"
+#include "patternfile.h"
+#include "rng.h"
+#include "spsc.h"
+#include "stats.h"
+#include "tempo.h"
+
+#include <SDL2/SDL_mixer.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std::string_literals;
+
+// A request from the main thread to the audio thread
+struct SequencerCommand {
+    enum Type {
+        Trigger,
+        PlaySound,
+        ChangeTempo,
+        TogglePlaying,
+        FadeOutAndTogglePlaying,
+        SetKit,
+        UseCurrentSettings,
+        ToggleRandomBeatSkip,
+        ToggleRandomBeatSilence,
+    };
+    Type type = Trigger;
+    Category category = Category::Kick;
+    int volume = 0;
+    int frames = 0; // a delay or the length of a fade-out
+    float echo = 0.0f; // how much of a triggered drum goes to the echo
+    double value = 0.0;
+    const Mix_Chunk* chunk = nullptr;
+    Kit kit {}; // the samples are pinned by the sender
+    int64_t sentAt = 0; // in nanoseconds, on the steady clock
+};
+
+inline int64_t steadyNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Something that the sequencer did, at a frame of its output, for tools that slice the output
+struct SequencerEvent {
+    enum Type {
+        Step, // the start of a step
+        Hit, // a sample started playing
+        Tempo, // the beats per minute changed, from this frame on
+    };
+    Type type = Step;
+    uint64_t frame = 0; // the frame of the output at which it happened
+    uint32_t step = 0; // the position in the pattern
+    Category category = Category::Kick;
+    int track = -1; // the pattern track, or -1 for hits that were not played by the pattern
+    SampleIndex sample = 0;
+    int volume = 0;
+    float gain = 0.0f; // what the sample is multiplied by: the volume, from 0 to 1, times the level of the sample
+    double beatsPerMinute = 0.0; // the new tempo, of a tempo change
+};
+
+// Add the hits and the tempo changes to a MIDI file
+inline void addMidiEvent(MidiWriter& midi, SequencerEvent const& event)
+{
+    if (event.type == SequencerEvent::Hit) {
+        midi.addHit(event.frame, event.category, event.volume);
+    } else if (event.type == SequencerEvent::Tempo) {
+        midi.setTempo(event.frame, event.beatsPerMinute);
+    }
+}
+
+// The echo that the drums can be sent to: every 100 ms, at half the volume of the one before
+const double defaultEchoMilliseconds = 100.0;
+const float defaultEchoFeedback = 0.5f;
+const float defaultEchoLevel = 0.5f;
+const double maxEchoMilliseconds = 2000.0;
+
+// Settings from a pattern file, with the samples of the kit looked up and pinned
+struct LoadedSettings {
+    PatternSettings settings;
+    std::array<std::optional<SampleIndex>, categoryCount> kit;
+};
+
+// Sequencer plays the drum pattern from within the audio callback. Steps are
+// triggered at exact frame offsets, by counting the frames that have been mixed,
+// and the start of each step is computed from a fixed origin, so that it never drifts.
+//
+// The public methods may be called from the main thread. They send commands to the
+// audio thread through a lock-free queue, which is emptied at the start of each buffer,
+// so that the audio thread never waits for a lock and never allocates.
+class Sequencer {
+public:
+    Sequencer(SampleLibrary& sampleLibrary, const Kit& startKit, const CategoryIndex& categoryIndex, uint64_t seed)
+        : library(sampleLibrary)
+        , kit(startKit)
+        , index(categoryIndex)
+        , controlRng(seed)
+        , planner(sampleLibrary, categoryIndex, jumpedRng(seed, 8))
+        , rng(seed)
+        , variation(jumpedRng(seed, 3))
+    {
+        // The kits that are picked from the main thread use a separate stream of random numbers
+        controlRng.jump();
+        controlRng.jump();
+
+        setEcho(defaultEchoMilliseconds, defaultEchoFeedback, defaultEchoLevel);
+
+        pinKit(library, kit);
+        acquireKit(library, kit);
+        publishKit();
+    }
+
+    // Must not be called while the sequencer is rendering. Unless stopKitPlanner has been called, the samples
+    // must not have been freed yet.
+    ~Sequencer()
+    {
+        planner.release();
+        LoadedSettings* loaded = nullptr;
+        while (newSettings.pop(loaded) || usedSettings.pop(loaded)) {
+            delete loaded;
+        }
+        delete pending;
+    }
+
+    // Can be passed to Mix_SetPostMix, with a pointer to the sequencer as the user data
+    static void postMix(void* udata, Uint8* stream, int len)
+    {
+        auto* sequencer = static_cast<Sequencer*>(udata);
+        const int frames = len / static_cast<int>(outputChannels * sizeof(int16_t));
+        const auto start = std::chrono::steady_clock::now();
+        sequencer->render(reinterpret_cast<int16_t*>(stream), frames);
+        sequencer->stats.recordCallback(start, std::chrono::steady_clock::now(), frames);
+    }
+
+    // Mix the next frames of the drum beat into the given interleaved stereo stream
+    void render(int16_t* stream, int frames)
+    {
+        runCommands();
+        int mixed = 0;
+        while (mixed < frames) {
+            while (beatPlaying && stepClock.next() <= frameClock) {
+                record({ .type = SequencerEvent::Step, .frame = frameClock, .step = static_cast<uint32_t>(beatCounter) });
+                step();
+                // The step may have loaded a new tempo, which is used from this step on
+                if (recordEvents && stepClock.tempo().beatsPerMinute != recordedTempo) {
+                    recordedTempo = stepClock.tempo().beatsPerMinute;
+                    record({ .type = SequencerEvent::Tempo, .frame = frameClock, .beatsPerMinute = recordedTempo });
+                }
+                stepClock.advance();
+            }
+            int n = frames - mixed;
+            if (beatPlaying) {
+                n = static_cast<int>(std::min<uint64_t>(n, stepClock.next() - frameClock));
+            }
+            if (toggleCountdown > 0) {
+                n = std::min(n, toggleCountdown);
+            }
+            playDueHits();
+            if (hitCount > 0) {
+                n = static_cast<int>(std::min<uint64_t>(n, hits[0].frame - frameClock));
+            }
+            mixer.mix(stream + mixed * outputChannels, n);
+            mixed += n;
+            frameClock += n;
+            if (!beatPlaying) {
+                // The steps keep their distance to each other, and to the time of the pause
+                stepClock.shift(n);
+            }
+            if (toggleCountdown > 0) {
+                toggleCountdown -= n;
+                if (toggleCountdown <= 0) {
+                    beatPlaying = !beatPlaying;
+                    hitCount = 0; // the fade-out also silences the delayed hits
+                }
+            }
+        }
+        library.setClock(frameClock);
+        stats.stolenVoices.store(mixer.stolenVoiceCount(), std::memory_order_relaxed);
+    }
+
+    // Pick and load the next kits on a worker thread, so that the audio thread never waits for them. Without it,
+    // they are picked on the thread that renders, which waits for the samples to load, like when rendering offline.
+    // Either way the output only depends on the seed. Must be called before rendering.
+    void startKitPlanner() { planner.start(); }
+
+    // Stop planning, and unpin the kits that were planned but not used. Must be called after rendering, before
+    // the samples are freed, and the sequencer must not render afterwards.
+    void stopKitPlanner() { planner.release(); }
+
+    // Record the steps and hits, to be read with nextEvent by one other thread. Must be called before rendering.
+    // Events are dropped, and counted, if they are not read in time.
+    void setEventRecording(bool enabled) { recordEvents = enabled; }
+
+    // Returns false if there are no more events
+    bool nextEvent(SequencerEvent& event) { return events.pop(event); }
+
+    // Play a drum from the current kit, after the given number of frames, and send the given part of it to the echo
+    void trigger(Category category, int volume, int delay = 0, float echo = 0.0f)
+    {
+        send({ .type = SequencerCommand::Trigger, .category = category, .volume = volume, .frames = delay, .echo = echo });
+    }
+
+    // Set the time between the repeats of the echo, how much quieter each repeat is, and how loud the first one is.
+    // Must not be called while rendering.
+    void setEcho(double milliseconds, float feedback, float level)
+    {
+        const double frames = std::clamp(milliseconds, 1.0, maxEchoMilliseconds) * outputSampleRate / 1000.0;
+        mixer.effects().setEcho(static_cast<int>(std::lround(frames)), feedback, level);
+    }
+
+    // Add a reverb to everything that is played, with the given impulse response, in interleaved stereo frames.
+    // Must not be called while rendering.
+    void setReverb(std::vector<float> const& impulse, float level) { mixer.effects().setReverb(impulse, level); }
+
+    // Play a sound that is not in the sample library, like a generated one.
+    // The chunk must stay valid for as long as the sequencer is rendering.
+    void playSound(const Mix_Chunk* chunk, int volume)
+    {
+        send({ .type = SequencerCommand::PlaySound, .volume = volume, .chunk = chunk });
+    }
+
+    // Use the settings from a pattern file, from the start of the next bar. The samples of the kit
+    // are loaded first, on the calling thread. Returns false, and sets the error message, if a
+    // sample of the kit could not be found. May be called from another thread than the other
+    // methods, but only from one thread at a time.
+    bool loadSettings(PatternSettings settings, std::string& error)
+    {
+        std::array<std::optional<SampleIndex>, categoryCount> samples;
+        for (int c = 0; c < categoryCount; ++c) {
+            if (settings.kitSamples[c]) {
+                samples[c] = library.find(*settings.kitSamples[c]);
+                if (!samples[c]) {
+                    error = "found no sample named " + *settings.kitSamples[c];
+                    return false;
+                }
+            }
+        }
+        for (auto const& sample : samples) {
+            if (sample) {
+                library.pin(*sample);
+                library.acquire(*sample);
+            }
+        }
+
+        // Free the settings that the audio thread is done with
+        LoadedSettings* used = nullptr;
+        while (usedSettings.pop(used)) {
+            delete used;
+        }
+
+        auto* loaded = new LoadedSettings { std::move(settings), samples };
+        if (!newSettings.push(loaded)) {
+            unpinSamples(loaded->kit);
+            delete loaded;
+            error = "the pattern changes too often";
+            return false;
+        }
+        return true;
+    }
+
+    // The length of a step, at the current tempo, rounded to whole frames. Must be called from the thread that renders.
+    int framesPerStep() const { return std::max(static_cast<int>(std::lround(stepClock.tempo().framesPerStep())), 1); }
+
+    // The counters and timings of the audio thread, which may be read from any thread
+    AudioStats const& statistics() const { return stats; }
+
+    // The current kit, as last seen by the audio thread
+    Kit currentKit() const
+    {
+        Kit current;
+        for (int c = 0; c < categoryCount; ++c) {
+            current.samples[c] = publishedKit[c].load(std::memory_order_relaxed);
+        }
+        return current;
+    }
+
+    void randomizeSamples()
+    {
+        // Pick and load the samples on this thread, the audio thread only switches to them
+        Kit picked = randomKit(index, controlRng);
+        pinKit(library, picked);
+        acquireKit(library, picked);
+        if (!send({ .type = SequencerCommand::SetKit, .kit = picked })) {
+            unpinKit(library, picked);
+        }
+    }
+
+    void togglePlaying() { send({ .type = SequencerCommand::TogglePlaying }); }
+
+    // Fade out over the given number of milliseconds, then toggle pause
+    void fadeOutAndTogglePlaying(int ms)
+    {
+        send({ .type = SequencerCommand::FadeOutAndTogglePlaying, .frames = outputSampleRate * ms / 1000 });
+    }
+
+    // Change the tempo by the given number of beats per minute, from the next step
+    void changeTempo(double delta) { send({ .type = SequencerCommand::ChangeTempo, .value = delta }); }
+
+    // Use the current settings, don't change samples
+    void useCurrentSettings() { send({ .type = SequencerCommand::UseCurrentSettings }); }
+
+    void toggleRandomBeatSkip() { send({ .type = SequencerCommand::ToggleRandomBeatSkip }); }
+
+    void toggleRandomBeatSilence() { send({ .type = SequencerCommand::ToggleRandomBeatSilence }); }
+
+    void printSampleIndices(std::ostream& out) const
+    {
+        const Kit current = currentKit();
+        out << "k " << current[Category::Kick] << " s " << current[Category::Snare] << " hh " << current[Category::HiHat]
+            << " c " << current[Category::Crash] << " t " << current[Category::Tom] << " r " << current[Category::Ride]
+            << " oh " << current[Category::OpHat] << std::endl;
+    }
+
+private:
+    // A hit that is queued to be played at a given frame
+    struct TimedHit {
+        uint64_t frame;
+        SampleIndex sample;
+        int volume;
+        Category category;
+        int track; // the pattern track, or -1
+        uint32_t step; // the position in the pattern that played it
+        float echo = 0.0f; // how much of it goes to the echo
+    };
+
+    // Returns false if the queue is full, then the command is dropped
+    bool send(SequencerCommand command)
+    {
+        command.sentAt = steadyNanoseconds();
+        if (!commands.push(command)) {
+            stats.droppedCommands.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Carry out the commands from the main thread, on the audio thread
+    void runCommands()
+    {
+        SequencerCommand command;
+        int64_t now = 0;
+        while (commands.pop(command)) {
+            if (now == 0) {
+                now = steadyNanoseconds();
+            }
+            stats.commandNanoseconds.add(static_cast<uint64_t>(std::max<int64_t>(now - command.sentAt, 0)));
+            switch (command.type) {
+            case SequencerCommand::Trigger:
+                schedule({ .frame = frameClock + command.frames, .sample = kit[command.category], .volume = command.volume,
+                    .category = command.category, .track = -1, .step = static_cast<uint32_t>(beatCounter), .echo = command.echo });
+                break;
+            case SequencerCommand::PlaySound:
+                mixer.play(command.chunk, command.volume);
+                break;
+            case SequencerCommand::ChangeTempo: {
+                Tempo tempo = stepClock.tempo();
+                tempo.beatsPerMinute += command.value;
+                stepClock.setTempo(tempo);
+                break;
+            }
+            case SequencerCommand::TogglePlaying:
+                beatPlaying = !beatPlaying;
+                break;
+            case SequencerCommand::FadeOutAndTogglePlaying:
+                mixer.fadeOut(command.frames);
+                toggleCountdown = command.frames;
+                break;
+            case SequencerCommand::SetKit:
+                unpinKit(library, kit);
+                kit = command.kit;
+                publishKit();
+                break;
+            case SequencerCommand::UseCurrentSettings:
+                beatPlaying = true;
+                useRandomBeatSkip = true;
+                useRandomBeatSilence = true;
+                useRandomSamples = false;
+                break;
+            case SequencerCommand::ToggleRandomBeatSkip:
+                useRandomBeatSkip = !useRandomBeatSkip;
+                break;
+            case SequencerCommand::ToggleRandomBeatSilence:
+                useRandomBeatSilence = !useRandomBeatSilence;
+                break;
+            }
+        }
+
+        // Newer settings replace the ones that are still waiting for the start of a bar
+        LoadedSettings* loaded = nullptr;
+        while (newSettings.pop(loaded)) {
+            if (pending != nullptr) {
+                unpinSamples(pending->kit);
+                retire(pending);
+            }
+            pending = loaded;
+        }
+    }
+
+    // Hand settings back to the thread that loads them, to be freed there
+    void retire(LoadedSettings* loaded)
+    {
+        // Never full, since it holds more than the settings that can be in use at the same time
+        usedSettings.push(loaded);
+    }
+
+    // A generator for the given seed, that has been jumped ahead the given number of times
+    static Rng jumpedRng(uint64_t seed, int jumps)
+    {
+        Rng generator(seed);
+        for (int i = 0; i < jumps; ++i) {
+            generator.jump();
+        }
+        return generator;
+    }
+
+    // Let the main thread see the current kit
+    void publishKit()
+    {
+        for (int c = 0; c < categoryCount; ++c) {
+            publishedKit[c].store(kit.samples[c], std::memory_order_relaxed);
+        }
+    }
+
+    void unpinSamples(std::array<std::optional<SampleIndex>, categoryCount> const& samples)
+    {
+        for (auto const& sample : samples) {
+            if (sample) {
+                library.unpin(*sample);
+            }
+        }
+    }
+
+    // Switch to the next kit, which the planner has picked and loaded ahead of time. If it is not ready
+    // yet, keep the current kit for now, instead of waiting for it in the audio thread.
+    void changeKit()
+    {
+        if (planner.swap(kit)) {
+            publishKit();
+        }
+    }
+
+    void record(SequencerEvent const& event)
+    {
+        if (recordEvents && !events.push(event)) {
+            stats.droppedEvents.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Play a hit now, whatever frame it was scheduled for
+    void play(TimedHit const& hit)
+    {
+        library.touch(hit.sample);
+        // The gain is only set once the sample has been seen
+        const Mix_Chunk* chunk = library[hit.sample];
+        if (chunk == nullptr) {
+            stats.missingSamples.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        const float gain = library.gain(hit.sample);
+        record({ .type = SequencerEvent::Hit, .frame = frameClock, .step = hit.step, .category = hit.category,
+            .track = hit.track, .sample = hit.sample, .volume = hit.volume,
+            .gain = static_cast<float>(hit.volume) / 128.0f * gain });
+        mixer.play(chunk, hit.volume, gain, hit.echo);
+    }
+
+    // Queue a hit to be played at the given frame. The queue is a binary heap in a fixed
+    // array, so that scheduling never allocates. If the queue is full, the hit is dropped.
+    // The delay must be shorter than the eviction margin of the sample library.
+    void schedule(TimedHit const& hit)
+    {
+        if (hitCount == hits.size()) {
+            stats.droppedHits.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        hits[hitCount++] = hit;
+        std::push_heap(hits.begin(), hits.begin() + hitCount, laterHit);
+    }
+
+    // Play the queued hits that are due
+    void playDueHits()
+    {
+        while (hitCount > 0 && hits[0].frame <= frameClock) {
+            std::pop_heap(hits.begin(), hits.begin() + hitCount, laterHit);
+            const auto& hit = hits[--hitCount];
+            stats.hitLatenessFrames.add(frameClock - hit.frame);
+            play(hit);
+        }
+    }
+
+    // Switch to the pending settings, if the current step is the first step of a bar.
+    // The patterns are swapped, so that the old one is freed by the thread that loaded the settings.
+    void applyPendingSettings()
+    {
+        if (pending == nullptr || beatCounter % pattern.stepsPerBar() != 0) {
+            return;
+        }
+        auto const& settings = pending->settings;
+        std::swap(pattern, pending->settings.pattern);
+        if (settings.tempo || settings.stepsPerBeat || settings.swing) {
+            Tempo tempo = stepClock.tempo();
+            tempo.beatsPerMinute = settings.tempo.value_or(tempo.beatsPerMinute);
+            tempo.stepsPerBeat = settings.stepsPerBeat.value_or(tempo.stepsPerBeat);
+            tempo.swing = settings.swing.value_or(tempo.swing);
+            stepClock.setTempo(tempo);
+        }
+        useRandomBeatSkip = settings.randomBeatSkip.value_or(useRandomBeatSkip);
+        useRandomBeatSilence = settings.randomBeatSilence.value_or(useRandomBeatSilence);
+        useRandomSamples = settings.randomSamples.value_or(useRandomSamples);
+        randomChanceBeatSkip = settings.chanceBeatSkip.value_or(randomChanceBeatSkip);
+        randomChanceBeatSilence = settings.chanceBeatSilence.value_or(randomChanceBeatSilence);
+        randomChanceNewSamples = settings.chanceNewSamples.value_or(randomChanceNewSamples);
+        for (int c = 0; c < categoryCount; ++c) {
+            if (pending->kit[c]) {
+                // The pin of the new sample now belongs to the kit
+                library.unpin(kit.samples[c]);
+                kit.samples[c] = *pending->kit[c];
+            }
+        }
+        publishKit();
+        beatCounter %= pattern.length();
+        retire(pending);
+        pending = nullptr;
+    }
+
+    // Trigger the drums for the current beat, and advance to the next one
+    void step()
+    {
+        applyPendingSettings();
+
+        auto r1 = rng.uniform(); // random number [0,1)
+        bool silenceBeat = useRandomBeatSilence && (r1 < randomChanceBeatSilence);
+        if (silenceBeat) {
+            return;
+        }
+
+        auto r2 = rng.uniform(); // random number [0,1)
+        bool skipBeat = useRandomBeatSkip && (r2 < randomChanceBeatSkip);
+        if (skipBeat) {
+            beatCounter++;
+            if (beatCounter >= pattern.length()) {
+                beatCounter = 0;
+            }
+            // Skipping may also reach the start of a bar
+            applyPendingSettings();
+        }
+
+        auto r3 = rng.uniform(); // random number [0,1)
+        bool newSamplesNow = (r3 < randomChanceNewSamples);
+        if (useRandomSamples && newSamplesNow) {
+            changeKit();
+        }
+
+        // Resolve the chance, the volume and the timing of each hit. The random numbers come in
+        // batches, and are only used by the events that vary, so that a pattern without variation
+        // plays the same with and without them.
+        int rolledTrack = -1;
+        bool trackPlays = true;
+        for (auto const& event : pattern.events(beatCounter)) {
+            if (event.track != rolledTrack) {
+                rolledTrack = event.track;
+                trackPlays = event.chance >= 1.0f || variation.next() < event.chance;
+            }
+            if (!trackPlays) {
+                continue;
+            }
+            int volume = event.volume;
+            if (event.minVolume < event.volume) {
+                volume = event.minVolume + static_cast<int>(variation.next() * static_cast<float>(event.volume - event.minVolume + 1));
+            }
+            uint32_t offset = event.offset;
+            if (event.jitterFrames > 0) {
+                offset += static_cast<uint32_t>(variation.next() * static_cast<float>(event.jitterFrames + 1));
+            }
+            const TimedHit hit { .frame = frameClock + offset, .sample = kit[event.category], .volume = volume,
+                .category = event.category, .track = event.track, .step = static_cast<uint32_t>(beatCounter) };
+            if (offset == 0) {
+                play(hit);
+            } else {
+                schedule(hit);
+            }
+        }
+
+        beatCounter++;
+        if (beatCounter >= pattern.length()) {
+            beatCounter = 0;
+        }
+    }
+
+    SampleLibrary& library;
+    Kit kit;
+    const CategoryIndex& index;
+
+    // Commands and settings from the other threads, and the settings that are handed back to be freed
+    SpscQueue<SequencerCommand, 256> commands;
+    SpscQueue<LoadedSettings*, 8> newSettings;
+    SpscQueue<LoadedSettings*, 16> usedSettings;
+
+    // Steps and hits, for the thread that reads them
+    SpscQueue<SequencerEvent, 1024> events;
+
+    AudioStats stats;
+
+    // The kit, for the main thread to read
+    std::array<std::atomic<SampleIndex>, categoryCount> publishedKit {};
+
+    // For the random choices on the main thread
+    Rng controlRng;
+
+    // Picks the next random kits ahead of time, with its own stream of random numbers
+    KitPlanner planner;
+
+    // Everything below is only used by the thread that renders
+
+    Mixer mixer;
+
+    static bool laterHit(const TimedHit& a, const TimedHit& b) { return a.frame > b.frame; }
+    std::array<TimedHit, 64> hits {};
+    size_t hitCount = 0;
+
+    // All random choices are made with this generator, so that a given seed always gives the same beat
+    Rng rng;
+
+    // The random numbers for the chances, volumes and timing of the hits, on a separate stream
+    RngBatch variation;
+
+    Pattern pattern = defaultPattern();
+    size_t beatCounter = 0; // the current step of the pattern
+
+    // Settings from a pattern file, that are waiting for the start of a bar. The kit samples are pinned.
+    LoadedSettings* pending = nullptr;
+
+    StepClock stepClock; // when the next step starts, and the tempo
+    int toggleCountdown = 0; // frames until the pause should be toggled, after a fade-out
+    uint64_t frameClock = 0; // frames rendered so far
+    bool recordEvents = false;
+    double recordedTempo = 0.0; // the tempo of the last tempo event
+
+    // Default settings for playing a drum beat
+    bool beatPlaying = true;
+
+    bool useRandomBeatSkip = true; // randomize the beat by skipping ahead?
+    bool useRandomBeatSilence = true; // randomize the beat by silencing some beats?
+    bool useRandomSamples = true; // randomize the samples?
+
+    double randomChanceBeatSkip = 0.6; // 60% chance of skipping a beat so that everything shifts
+    double randomChanceBeatSilence = 0.005; // 0.5% chance of silencing a beat
+    double randomChanceNewSamples = 0.01; // 1% chance of choosing other samples
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// The build targets the baseline instruction set, which has SSE2 on x86-64. The AVX2 code paths are
+// compiled for AVX2 on their own, with __attribute__((target("avx2"))), and only taken if the CPU has it.
+// They must give the same results as the SSE2 paths, so that the output does not depend on the CPU.
+inline bool cpuHasAvx2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// SpscQueue is a fixed size, lock-free queue for one producer thread and one consumer thread.
+// Neither side ever blocks or allocates, so it can be used from the audio thread.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "the capacity must be a power of two");
+
+public:
+    // Returns false if the queue is full
+    bool push(const T& value)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T& value)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, Capacity> items {};
+    alignas(64) std::atomic<size_t> head { 0 }; // written by the consumer
+    alignas(64) std::atomic<size_t> tail { 0 }; // written by the producer
+};
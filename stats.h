@@ -0,0 +1,212 @@
+#pragma once
+
+#include "mixer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Histogram counts values in power of two buckets: bucket 0 holds 0, and bucket b holds [2^(b-1), 2^b).
+// It is written by one thread, without locking, and can be read by any thread.
+class Histogram {
+public:
+    static const int bucketCount = 65;
+
+    void add(uint64_t value)
+    {
+        const int b = 64 - std::countl_zero(value);
+        buckets[b].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        if (value > largest.load(std::memory_order_relaxed)) {
+            largest.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+
+    uint64_t mean() const
+    {
+        const uint64_t n = count();
+        return n == 0 ? 0 : sum.load(std::memory_order_relaxed) / n;
+    }
+
+    uint64_t bucket(int b) const { return buckets[b].load(std::memory_order_relaxed); }
+
+    // The largest value in bucket b
+    static uint64_t bucketLimit(int b) { return b == 0 ? 0 : b == 64 ? UINT64_MAX : (uint64_t { 1 } << b) - 1; }
+
+    // An upper bound for the given quantile, from 0 to 1. Never larger than the largest value.
+    uint64_t quantile(double q) const
+    {
+        const uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        const auto rank = static_cast<uint64_t>(q * static_cast<double>(n - 1)) + 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < bucketCount; ++b) {
+            seen += bucket(b);
+            if (seen >= rank) {
+                return std::min(bucketLimit(b), max());
+            }
+        }
+        return max();
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, bucketCount> buckets {};
+    std::atomic<uint64_t> total { 0 };
+    std::atomic<uint64_t> sum { 0 };
+    std::atomic<uint64_t> largest { 0 };
+};
+
+// AudioStats counts what happens in the audio thread, so that late or lost hits can be noticed,
+// and the buffer size can be tuned. Except for droppedCommands, which is counted by the threads
+// that send commands, everything is written by the audio thread only.
+struct AudioStats {
+    Histogram callbackNanoseconds; // the time spent in each audio callback
+    Histogram commandNanoseconds; // from when a command is sent, until the audio thread carries it out
+    Histogram hitLatenessFrames; // how many frames after the scheduled frame a hit was played
+    std::atomic<uint64_t> callbacks { 0 };
+    std::atomic<uint64_t> budgetNanoseconds { 0 }; // the length of the last buffer
+    std::atomic<uint64_t> overBudget { 0 }; // callbacks that took longer than the length of their buffer
+    std::atomic<uint64_t> underruns { 0 }; // callbacks that came too late, so that the device probably ran dry
+    std::atomic<uint64_t> stolenVoices { 0 }; // voices that were cut off, because all voices were busy
+    std::atomic<uint64_t> missingSamples { 0 }; // hits that could not be played, because the sample was not loaded
+    std::atomic<uint64_t> droppedHits { 0 }; // hits that could not be scheduled, because the queue was full
+    std::atomic<uint64_t> droppedCommands { 0 }; // commands that could not be sent, because the queue was full
+    std::atomic<uint64_t> droppedEvents { 0 }; // recorded events that were not read in time
+
+    // Record an audio callback that started and ended at the given times, and mixed the given number of frames
+    void recordCallback(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, int frames)
+    {
+        using std::chrono::nanoseconds;
+        const auto duration = static_cast<uint64_t>(std::chrono::duration_cast<nanoseconds>(end - start).count());
+        const auto budget = static_cast<uint64_t>(frames) * 1000000000 / outputSampleRate;
+        callbackNanoseconds.add(duration);
+        budgetNanoseconds.store(budget, std::memory_order_relaxed);
+        callbacks.fetch_add(1, std::memory_order_relaxed);
+        if (duration > budget) {
+            overBudget.fetch_add(1, std::memory_order_relaxed);
+        }
+        // The callbacks should come once per buffer. Allow for some jitter before counting an underrun.
+        if (previousStart && static_cast<uint64_t>(std::chrono::duration_cast<nanoseconds>(start - *previousStart).count()) > budget * 3 / 2) {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        previousStart = start;
+    }
+
+private:
+    std::optional<std::chrono::steady_clock::time_point> previousStart;
+};
+
+inline uint64_t loadRelaxed(std::atomic<uint64_t> const& counter) { return counter.load(std::memory_order_relaxed); }
+
+// Write a one line summary, with the times in microseconds
+inline void printStatsLine(std::ostream& out, AudioStats const& stats)
+{
+    auto us = [](uint64_t ns) { return std::to_string(ns / 1000); };
+    out << "stats: callbacks " << loadRelaxed(stats.callbacks)
+        << ", callback us p50 " << us(stats.callbackNanoseconds.quantile(0.5))
+        << " p99 " << us(stats.callbackNanoseconds.quantile(0.99))
+        << " max " << us(stats.callbackNanoseconds.max())
+        << " budget " << us(loadRelaxed(stats.budgetNanoseconds))
+        << ", over budget " << loadRelaxed(stats.overBudget)
+        << ", underruns " << loadRelaxed(stats.underruns)
+        << ", command us p99 " << us(stats.commandNanoseconds.quantile(0.99))
+        << ", late hits " << stats.hitLatenessFrames.count() - stats.hitLatenessFrames.bucket(0)
+        << ", stolen voices " << loadRelaxed(stats.stolenVoices)
+        << ", missing samples " << loadRelaxed(stats.missingSamples)
+        << ", dropped hits " << loadRelaxed(stats.droppedHits)
+        << ", dropped commands " << loadRelaxed(stats.droppedCommands)
+        << ", dropped events " << loadRelaxed(stats.droppedEvents) << std::endl;
+}
+
+inline void writeHistogramJson(std::ostream& out, Histogram const& histogram)
+{
+    out << "{\"count\": " << histogram.count() << ", \"mean\": " << histogram.mean()
+        << ", \"p50\": " << histogram.quantile(0.5) << ", \"p99\": " << histogram.quantile(0.99)
+        << ", \"max\": " << histogram.max() << ", \"buckets\": [";
+    // Only the buckets that are in use, as [largest value, count] pairs
+    bool first = true;
+    for (int b = 0; b < Histogram::bucketCount; ++b) {
+        if (histogram.bucket(b) > 0) {
+            out << (first ? "" : ", ") << "[" << Histogram::bucketLimit(b) << ", " << histogram.bucket(b) << "]";
+            first = false;
+        }
+    }
+    out << "]}";
+}
+
+// Write all the statistics as a JSON object
+inline void writeStatsJson(std::ostream& out, AudioStats const& stats)
+{
+    out << "{\n"
+        << "  \"sampleRate\": " << outputSampleRate << ",\n"
+        << "  \"bufferFrames\": " << outputBufferFrames << ",\n"
+        << "  \"callbacks\": " << loadRelaxed(stats.callbacks) << ",\n"
+        << "  \"budgetNanoseconds\": " << loadRelaxed(stats.budgetNanoseconds) << ",\n"
+        << "  \"overBudget\": " << loadRelaxed(stats.overBudget) << ",\n"
+        << "  \"underruns\": " << loadRelaxed(stats.underruns) << ",\n"
+        << "  \"stolenVoices\": " << loadRelaxed(stats.stolenVoices) << ",\n"
+        << "  \"missingSamples\": " << loadRelaxed(stats.missingSamples) << ",\n"
+        << "  \"droppedHits\": " << loadRelaxed(stats.droppedHits) << ",\n"
+        << "  \"droppedCommands\": " << loadRelaxed(stats.droppedCommands) << ",\n"
+        << "  \"droppedEvents\": " << loadRelaxed(stats.droppedEvents) << ",\n"
+        << "  \"callbackNanoseconds\": ";
+    writeHistogramJson(out, stats.callbackNanoseconds);
+    out << ",\n  \"commandNanoseconds\": ";
+    writeHistogramJson(out, stats.commandNanoseconds);
+    out << ",\n  \"hitLatenessFrames\": ";
+    writeHistogramJson(out, stats.hitLatenessFrames);
+    out << "\n}\n";
+}
+
+// StatsReporter prints a stats line to stderr at a fixed interval, on its own thread
+class StatsReporter {
+public:
+    ~StatsReporter() { stop(); }
+
+    void start(AudioStats const& stats, double intervalSeconds)
+    {
+        stop();
+        running = true;
+        thread = std::thread([this, &stats, interval = std::chrono::duration<double>(intervalSeconds)]() {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!wakeup.wait_for(guard, interval, [this]() { return !running; })) {
+                printStatsLine(std::cerr, stats);
+            }
+        });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running = false;
+        }
+        wakeup.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool running = false;
+    std::thread thread;
+};
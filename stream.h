@@ -0,0 +1,153 @@
+#pragma once
+
+#include "control.h"
+#include "mixer.h"
+#include "sequencer.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// The number of frames that are rendered and written at a time, when streaming
+const int streamBlockFrames = 256;
+
+// The sample formats that can be streamed, both interleaved stereo in the native byte order
+enum class StreamFormat {
+    S16, // 16-bit signed integers, as mixed
+    F32, // 32-bit floats, from -1 to 1
+};
+
+// What decides how fast the stream is written
+enum class StreamPacing {
+    Clock, // in realtime, by the wall clock
+    Reader, // as fast as the reader reads, which blocks the writes when the pipe is full
+};
+
+inline std::optional<StreamFormat> parseStreamFormat(std::string const& name)
+{
+    if (name == "s16") {
+        return StreamFormat::S16;
+    }
+    if (name == "f32") {
+        return StreamFormat::F32;
+    }
+    return std::nullopt;
+}
+
+inline std::optional<StreamPacing> parseStreamPacing(std::string const& name)
+{
+    if (name == "clock") {
+        return StreamPacing::Clock;
+    }
+    if (name == "reader") {
+        return StreamPacing::Reader;
+    }
+    return std::nullopt;
+}
+
+// Open a file or a named pipe for writing. Opening a named pipe waits for a reader.
+// Returns -1 if it could not be opened.
+inline int openStreamOutput(std::string const& path)
+{
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+// Write all the bytes, also when the writes are partial. Returns false if the reader has gone away.
+inline bool writeAll(int fd, const void* data, size_t bytes)
+{
+    const auto* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        const ssize_t written = write(fd, p, bytes);
+        if (written < 0) {
+            if (errno == EINTR && !quitSignalled) {
+                continue;
+            }
+            return false;
+        }
+        p += written;
+        bytes -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+inline void writeEventCsvHeader(std::ostream& out) { out << "frame,type,step,category,track,sample,volume\n"; }
+
+// Write an event as a line of CSV. Steps leave the fields of the hits empty, and tempo changes are skipped.
+inline void writeEventCsv(std::ostream& out, SequencerEvent const& event)
+{
+    if (event.type == SequencerEvent::Tempo) {
+        return;
+    }
+    out << event.frame << ',';
+    if (event.type == SequencerEvent::Step) {
+        out << "step," << event.step << ",,,,\n";
+        return;
+    }
+    out << "hit," << event.step << ',' << categoryNames[static_cast<int>(event.category)] << ',' << event.track << ','
+        << event.sample << ',' << event.volume << '\n';
+}
+
+// Stream the drums to the given file descriptor, until the given number of frames has been written,
+// or forever if it is 0. Stops early when the reader goes away or a quit signal arrives. If events
+// is given, the steps and hits are written to it as CSV, and if midi is given, the hits are added to it.
+// Either way the sequencer must be recording events. Returns the number of frames that were written.
+inline uint64_t streamPcm(Sequencer& sequencer, int fd, StreamFormat format, StreamPacing pacing, uint64_t totalFrames, std::ostream* events,
+    MidiWriter* midi = nullptr)
+{
+    using clock = std::chrono::steady_clock;
+    std::vector<int16_t> buffer(streamBlockFrames * outputChannels);
+    std::vector<float> floats(format == StreamFormat::F32 ? buffer.size() : 0);
+    if (events != nullptr) {
+        writeEventCsvHeader(*events);
+    }
+    const auto start = clock::now();
+    uint64_t written = 0;
+    while (!quitSignalled && (totalFrames == 0 || written < totalFrames)) {
+        const int n = static_cast<int>(totalFrames == 0 ? streamBlockFrames : std::min<uint64_t>(streamBlockFrames, totalFrames - written));
+        if (pacing == StreamPacing::Clock) {
+            // Each block is due at a fixed time after the start, so that the stream never drifts from the clock
+            const auto due = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(static_cast<double>(written) / outputSampleRate));
+            std::this_thread::sleep_until(due);
+        }
+        std::fill(buffer.begin(), buffer.end(), 0);
+        sequencer.render(buffer.data(), n);
+        const size_t samples = static_cast<size_t>(n) * outputChannels;
+        bool ok = false;
+        if (format == StreamFormat::F32) {
+            for (size_t i = 0; i < samples; ++i) {
+                floats[i] = static_cast<float>(buffer[i]) / 32768.0f;
+            }
+            ok = writeAll(fd, floats.data(), samples * sizeof(float));
+        } else {
+            ok = writeAll(fd, buffer.data(), samples * sizeof(int16_t));
+        }
+        if (events != nullptr || midi != nullptr) {
+            SequencerEvent event;
+            bool any = false;
+            while (sequencer.nextEvent(event)) {
+                if (events != nullptr) {
+                    writeEventCsv(*events, event);
+                    any = true;
+                }
+                if (midi != nullptr) {
+                    addMidiEvent(*midi, event);
+                }
+            }
+            if (any) {
+                events->flush();
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        written += n;
+    }
+    return written;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "mixer.h"
+
+#include <SDL2/SDL_mixer.h>
+
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+const std::array<double, 12> bassFrequencies = {
+    16.35, // C0
+    17.32, // C#0/Db0
+    18.35, // D0
+    19.45, // D#0/Eb0
+    20.60, // E0
+    21.83, // F0
+    23.12, // F#0/Gb0
+    24.50, // G0
+    25.96, // G#0/Ab0
+    27.50, // A0
+    29.14, // A#0/Bb0
+    30.87 // B0
+};
+
+// Generate a low-pass filtered sawtooth wave, as mono samples.
+// The phase is advanced incrementally, so that no division or modulo is needed per sample.
+inline std::vector<int16_t> generateSawtoothWave(double freq, int sampleRate, int durationMs, double cutoffFreq = 500.0)
+{
+    const int amplitude = 32767;
+    const int totalSamples = sampleRate * durationMs / 1000;
+    std::vector<int16_t> wave(totalSamples);
+    const double rc = 1.0 / (cutoffFreq * 2 * M_PI);
+    const double dt = 1.0 / sampleRate;
+    const double alpha = dt / (rc + dt);
+    const double phaseStep = freq / sampleRate;
+
+    double phase = 0.0; // position within the current period, [0,1)
+    double previous = 0.0; // Previous filtered sample
+
+    for (int i = 0; i < totalSamples; ++i) {
+        double sample = 2.0 * phase - 1.0;
+        phase += phaseStep;
+        if (phase >= 1.0) {
+            phase -= 1.0;
+        }
+
+        // Apply the low-pass filter
+        sample = alpha * sample + (1.0 - alpha) * previous;
+        previous = sample;
+
+        // Scale and convert to 16-bit integer
+        wave[i] = static_cast<int16_t>(amplitude * sample);
+    }
+    return wave;
+}
+
+// Generate a kick drum with a falling pitch and an exponential decay, as mono samples.
+// The oscillator is a rotating phasor, and the rotation itself is rotated by a fixed amount
+// per sample for the linear pitch decrease, so that sin and exp are only called up front.
+inline std::vector<int16_t> generateKickDrum(int sampleRate, int durationMs)
+{
+    const int amplitude = 32767; // Max amplitude for 16-bit audio
+    const int totalSamples = sampleRate * durationMs / 1000;
+    std::vector<int16_t> wave(totalSamples);
+    const double frequencyStart = 120.0; // Start frequency slightly lowered
+    const double frequencyEnd = 60.0; // End frequency for a deeper sound
+    const double envelopeStrength = 0.3; // Adjust the decay to be less abrupt
+
+    const double pitchStep = 2 * M_PI * (frequencyEnd - frequencyStart) / (static_cast<double>(sampleRate) * totalSamples);
+    const std::complex<double> chirp = std::polar(1.0, pitchStep);
+    std::complex<double> rotation = std::polar(1.0, 2 * M_PI * frequencyStart / sampleRate);
+    std::complex<double> phasor = 1.0;
+    const double decay = std::exp(-envelopeStrength / sampleRate);
+    double envelope = amplitude;
+
+    for (int i = 0; i < totalSamples; ++i) {
+        wave[i] = static_cast<int16_t>(envelope * phasor.imag());
+        phasor *= rotation;
+        rotation *= chirp;
+        envelope *= decay;
+    }
+    return wave;
+}
+
+// A generated sound, in the output format, that can be given to the Mixer
+class SynthVoice {
+public:
+    // Copy the mono samples to all the output channels
+    explicit SynthVoice(std::vector<int16_t> const& mono)
+        : data(mono.size() * outputChannels)
+    {
+        for (size_t i = 0; i < mono.size(); ++i) {
+            for (int c = 0; c < outputChannels; ++c) {
+                data[i * outputChannels + c] = mono[i];
+            }
+        }
+        chunk.allocated = 0;
+        chunk.abuf = reinterpret_cast<Uint8*>(data.data());
+        chunk.alen = static_cast<Uint32>(data.size() * sizeof(int16_t));
+        chunk.volume = MIX_MAX_VOLUME;
+    }
+
+    // The chunk points into this voice, so it must not be copied
+    SynthVoice(SynthVoice const&) = delete;
+    SynthVoice& operator=(SynthVoice const&) = delete;
+
+    const Mix_Chunk* get() const { return &chunk; }
+
+private:
+    std::vector<int16_t> data;
+    Mix_Chunk chunk {};
+};
+
+const int sawtoothDurationMs = 150;
+const int kickDrumDurationMs = 200;
+
+// SynthBank holds the generated sounds, which are all rendered once, at startup,
+// so that playing them never blocks or allocates
+class SynthBank {
+public:
+    SynthBank()
+    {
+        for (size_t i = 0; i < bassFrequencies.size(); ++i) {
+            bass[i].emplace(generateSawtoothWave(bassFrequencies[i] * 2.0, outputSampleRate, sawtoothDurationMs));
+        }
+        kick.emplace(generateKickDrum(outputSampleRate, kickDrumDurationMs));
+    }
+
+    // The sawtooth bass sound for the given index into bassFrequencies
+    const Mix_Chunk* bassSound(size_t i) const { return bass[i]->get(); }
+
+    const Mix_Chunk* kickSound() const { return kick->get(); }
+
+private:
+    std::array<std::optional<SynthVoice>, bassFrequencies.size()> bass;
+    std::optional<SynthVoice> kick;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "mixer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// The range of the tempo, in beats per minute
+const double minBeatsPerMinute = 10.0;
+const double maxBeatsPerMinute = 1000.0;
+
+// The most steps that a beat can be divided into
+const int maxStepsPerBeat = 64;
+
+// The most that every second step can be delayed, as a fraction of a step
+const double maxSwing = 0.5;
+
+// Tempo is the speed and the feel of the beat
+struct Tempo {
+    double beatsPerMinute = 125.0;
+    int stepsPerBeat = 4;
+    double swing = 0.0; // how much every second step is delayed, from 0 (straight) to 0.5 (a dotted feel)
+
+    // The length of a step, without swing. Not rounded, so that the rounding errors do not add up.
+    double framesPerStep() const { return outputSampleRate * 60.0 / (beatsPerMinute * stepsPerBeat); }
+};
+
+// StepClock gives the frame at which each step starts. Step n starts at the origin plus n step lengths,
+// so that a step that is played late does not delay the steps after it, and long sessions stay in phase.
+// A new tempo is used from the step after the next one, with the next step as the new origin.
+class StepClock {
+public:
+    // The frame at which the next step starts
+    uint64_t next() const { return nextFrame; }
+
+    // The latest tempo, which may not be in use until the next step
+    Tempo const& tempo() const { return latest; }
+
+    void setTempo(Tempo const& t)
+    {
+        latest = t;
+        latest.beatsPerMinute = std::clamp(latest.beatsPerMinute, minBeatsPerMinute, maxBeatsPerMinute);
+        latest.stepsPerBeat = std::clamp(latest.stepsPerBeat, 1, maxStepsPerBeat);
+        latest.swing = std::clamp(latest.swing, 0.0, maxSwing);
+        tempoChanged = true;
+    }
+
+    // The next step has started, find the start of the one after it
+    void advance()
+    {
+        if (tempoChanged) {
+            // The step that just started is the new origin, without its swing
+            origin += static_cast<double>(count) * period;
+            count = 0;
+            period = latest.framesPerStep();
+            tempoChanged = false;
+        }
+        ++count;
+        ++steps;
+        const double swing = steps % 2 == 1 ? latest.swing * period : 0.0;
+        nextFrame = static_cast<uint64_t>(std::llround(origin + static_cast<double>(count) * period + swing));
+    }
+
+    // Move the clock ahead by the given number of frames, like when the beat is paused
+    void shift(uint64_t frames)
+    {
+        origin += static_cast<double>(frames);
+        nextFrame += frames;
+    }
+
+private:
+    Tempo latest;
+    double period = Tempo {}.framesPerStep(); // the step length in use
+    double origin = 0.0; // the frame at which the step count was last reset
+    uint64_t count = 0; // the steps since the origin
+    uint64_t steps = 0; // the steps since the start, for the swing
+    uint64_t nextFrame = 0;
+    bool tempoChanged = false;
+};